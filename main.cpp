@@ -7,60 +7,414 @@
 #include <algorithm>
 #include <iomanip>
 #include <utility>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <climits>
+#include <cerrno>
+#include <cctype>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <string_view>
+#include <thread>
+#include <filesystem>
+#include <cstring>
+#include <array>
+#include <tuple>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 using std::literals::string_literals::operator""s;
 
-string ignoreKeysCasePermutations(string key) {
-    long end = (long)key.find('\'');
-    transform(key.begin(), key.begin() + end, key.begin(), ::tolower);
-    return key;
+// Operations tracked by the built-in instrumentation.
+enum MetricOp {
+    OP_BINARY_SEARCH,
+    OP_READ_RECORD,
+    OP_MARK_DELETED,
+    OP_SAVE_INDEXES,
+    OP_LOAD_INDEXES,
+    OP_PROCESS_QUERY,
+    OP_EXPORT_SNAPSHOT,
+    OP_WRITE_RECORD,
+    OP_COUNT
+};
+
+const char* const METRIC_OP_NAMES[OP_COUNT] = {
+    "binary_search", "read_record", "mark_deleted", "save_indexes", "load_indexes", "process_query",
+    "export_snapshot", "write_record"
+};
+
+// Bloom filters placed in front of the primary and secondary indexes.
+enum BloomId {
+    BLOOM_DOCTOR,
+    BLOOM_APPOINTMENT,
+    BLOOM_DOCTOR_NAME,
+    BLOOM_APPOINTMENT_DOCTOR,
+    BLOOM_COUNT
+};
+
+const char* const BLOOM_NAMES[BLOOM_COUNT] = {
+    "doctor_id", "appointment_id", "doctor_name", "appointment_doctor_id"
+};
+
+// Lock-free counters and log2 latency histograms, cheap enough to stay on all the time.
+// Bucket i counts calls that took less than 2^(i + FIRST_BUCKET_SHIFT) nanoseconds;
+// the last bucket catches everything slower.
+class Metrics {
+public:
+    static const int BUCKET_COUNT = 20;
+    static const int FIRST_BUCKET_SHIFT = 7;  // first bucket is < 128ns
+    const string METRICS_FILE = "metrics.prom";
+
+    void record(MetricOp op, uint64_t nanos);
+    void addBytesRead(MetricOp op, uint64_t bytes) { bytesRead[op].fetch_add(bytes, memory_order_relaxed); }
+    void addBytesWritten(MetricOp op, uint64_t bytes) { bytesWritten[op].fetch_add(bytes, memory_order_relaxed); }
+    uint64_t totalBytesWritten() const;
+    void recordBloomCheck(BloomId id, bool mightContain);
+    void recordBloomFalsePositive(BloomId id) { bloomFalsePositives[id].fetch_add(1, memory_order_relaxed); }
+    void display();
+    void dumpPrometheus();
+
+private:
+    atomic<uint64_t> calls[OP_COUNT] = {};
+    atomic<uint64_t> totalNanos[OP_COUNT] = {};
+    atomic<uint64_t> maxNanos[OP_COUNT] = {};
+    atomic<uint64_t> buckets[OP_COUNT][BUCKET_COUNT] = {};
+    atomic<uint64_t> bytesRead[OP_COUNT] = {};
+    atomic<uint64_t> bytesWritten[OP_COUNT] = {};
+    atomic<uint64_t> bloomChecks[BLOOM_COUNT] = {};
+    atomic<uint64_t> bloomNegatives[BLOOM_COUNT] = {};
+    atomic<uint64_t> bloomFalsePositives[BLOOM_COUNT] = {};
+
+    static int bucketFor(uint64_t nanos);
+    static uint64_t bucketUpperBound(int bucket) { return 1ULL << (bucket + FIRST_BUCKET_SHIFT); }
+    uint64_t percentile(MetricOp op, double fraction);
+};
+
+Metrics metrics;
+
+uint64_t Metrics::totalBytesWritten() const {
+    uint64_t total = 0;
+    for (int op = 0; op < OP_COUNT; op++)
+        total += bytesWritten[op].load(memory_order_relaxed);
+    return total;
 }
 
-bool isValidQuery(const string& query) {
-    bool startsWithSelectFrom = query.substr(0, 11) == "select*from";
-    bool startsWithSelectDoctorNameFrom = query.substr(0, 20) == "selectdoctornamefrom";
-    if (!startsWithSelectFrom && !startsWithSelectDoctorNameFrom) {
-        cout << "Make sure the query starts with 'select * from' or 'select doctor name from'.\n";
-        return false; // Invalid query if it doesn't start with either format
+int Metrics::bucketFor(uint64_t nanos) {
+    int bucket = 0;
+    nanos >>= FIRST_BUCKET_SHIFT;
+    while (nanos && bucket < BUCKET_COUNT - 1) {
+        nanos >>= 1;
+        bucket++;
     }
-    size_t fromPos = startsWithSelectFrom ? 11 : 20;  // Adjust starting point based on the format
-    if (query.substr(fromPos, 7) != "doctors" && query.substr(fromPos, 12) != "appointments") {
-        cout << "Invalid table name.\n";
-        return false;
+    return bucket;
+}
+
+void Metrics::record(MetricOp op, uint64_t nanos) {
+    calls[op].fetch_add(1, memory_order_relaxed);
+    totalNanos[op].fetch_add(nanos, memory_order_relaxed);
+    buckets[op][bucketFor(nanos)].fetch_add(1, memory_order_relaxed);
+    uint64_t currentMax = maxNanos[op].load(memory_order_relaxed);
+    while (nanos > currentMax && !maxNanos[op].compare_exchange_weak(currentMax, nanos, memory_order_relaxed)) {
     }
-    size_t wherePos = query.find("where");
-    if (wherePos == string::npos) {
-        cout << "where clause missing.\n";
-        return false; // 'where' clause missing
+}
+
+void Metrics::recordBloomCheck(BloomId id, bool mightContain) {
+    bloomChecks[id].fetch_add(1, memory_order_relaxed);
+    if (!mightContain)
+        bloomNegatives[id].fetch_add(1, memory_order_relaxed);
+}
+
+// Upper bound of the bucket holding the requested fraction of calls.
+uint64_t Metrics::percentile(MetricOp op, double fraction) {
+    uint64_t total = calls[op].load(memory_order_relaxed);
+    if (total == 0)
+        return 0;
+    uint64_t target = (uint64_t)(fraction * total);
+    uint64_t slowest = maxNanos[op].load(memory_order_relaxed);
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKET_COUNT - 1; i++) {
+        seen += buckets[op][i].load(memory_order_relaxed);
+        if (seen > target)
+            return min(bucketUpperBound(i), slowest);
     }
-    size_t fieldStartPos = wherePos + 5; // Skip "where"
-    if (query.substr(fieldStartPos, 8) != "doctorid" &&
-        query.substr(fieldStartPos, 10) != "doctorname" &&
-        query.substr(fieldStartPos, 13) != "appointmentid") {
-        cout << "Invalid field name.\n";
-        return false;
+    return slowest;
+}
+
+void Metrics::display() {
+    cout << "\n--- Operation Statistics ---\n";
+    cout << left << setw(16) << "operation" << right << setw(10) << "calls" << setw(12) << "avg(us)"
+         << setw(12) << "p50(us)" << setw(12) << "p99(us)" << setw(12) << "max(us)"
+         << setw(14) << "bytes read" << setw(14) << "bytes written" << "\n";
+    for (int op = 0; op < OP_COUNT; op++) {
+        uint64_t n = calls[op].load(memory_order_relaxed);
+        double avg = n ? totalNanos[op].load(memory_order_relaxed) / 1000.0 / n : 0.0;
+        cout << left << setw(16) << METRIC_OP_NAMES[op] << right << setw(10) << n
+             << fixed << setprecision(2) << setw(12) << avg
+             << setw(12) << percentile((MetricOp)op, 0.50) / 1000.0
+             << setw(12) << percentile((MetricOp)op, 0.99) / 1000.0
+             << setw(12) << maxNanos[op].load(memory_order_relaxed) / 1000.0
+             << setw(14) << bytesRead[op].load(memory_order_relaxed)
+             << setw(14) << bytesWritten[op].load(memory_order_relaxed) << "\n";
+    }
+    cout << "\n" << left << setw(24) << "bloom filter" << right << setw(10) << "checks"
+         << setw(12) << "negatives" << setw(16) << "false positive" << "\n";
+    for (int id = 0; id < BLOOM_COUNT; id++) {
+        cout << left << setw(24) << BLOOM_NAMES[id] << right
+             << setw(10) << bloomChecks[id].load(memory_order_relaxed)
+             << setw(12) << bloomNegatives[id].load(memory_order_relaxed)
+             << setw(16) << bloomFalsePositives[id].load(memory_order_relaxed) << "\n";
     }
-    size_t firstQuotePos = query.find('\'', wherePos);
-    if (firstQuotePos == string::npos) {
-        cout << "Field value must be enclosed in single quotes.\n";
-        return false; // Missing opening quote
+    cout.unsetf(ios::fixed);
+    cout << setprecision(6) << "----------------------------\n";
+}
+
+// Writes the counters in the Prometheus text exposition format.
+void Metrics::dumpPrometheus() {
+    ofstream file(METRICS_FILE, ios::out | ios::trunc);
+    if (!file) {
+        cerr << "Error: Unable to open " << METRICS_FILE << " for writing." << endl;
+        return;
     }
-    size_t secondQuotePos = query.find('\'', firstQuotePos + 1);
-    if (secondQuotePos == string::npos) {
-        cout << "Unclosed quote.\n";
-        return false; // Missing closing quote
+    file << "# HELP hcms_operation_duration_seconds Latency of instrumented operations.\n";
+    file << "# TYPE hcms_operation_duration_seconds histogram\n";
+    for (int op = 0; op < OP_COUNT; op++) {
+        uint64_t cumulative = 0;
+        for (int i = 0; i < BUCKET_COUNT; i++) {
+            cumulative += buckets[op][i].load(memory_order_relaxed);
+            file << "hcms_operation_duration_seconds_bucket{op=\"" << METRIC_OP_NAMES[op] << "\",le=\"";
+            if (i == BUCKET_COUNT - 1)
+                file << "+Inf";
+            else
+                file << bucketUpperBound(i) / 1e9;
+            file << "\"} " << cumulative << "\n";
+        }
+        file << "hcms_operation_duration_seconds_sum{op=\"" << METRIC_OP_NAMES[op] << "\"} "
+             << totalNanos[op].load(memory_order_relaxed) / 1e9 << "\n";
+        file << "hcms_operation_duration_seconds_count{op=\"" << METRIC_OP_NAMES[op] << "\"} "
+             << calls[op].load(memory_order_relaxed) << "\n";
     }
-    string fieldValue = query.substr(firstQuotePos + 1, secondQuotePos - firstQuotePos - 1);
-    if (fieldValue.empty()) {
-        cout << "Empty field value.\n";
-        return false; // Empty field value
+    file << "# HELP hcms_bytes_read_total Bytes read from data and index files.\n";
+    file << "# TYPE hcms_bytes_read_total counter\n";
+    for (int op = 0; op < OP_COUNT; op++)
+        file << "hcms_bytes_read_total{op=\"" << METRIC_OP_NAMES[op] << "\"} " << bytesRead[op].load(memory_order_relaxed) << "\n";
+    file << "# HELP hcms_bytes_written_total Bytes written to data and index files.\n";
+    file << "# TYPE hcms_bytes_written_total counter\n";
+    for (int op = 0; op < OP_COUNT; op++)
+        file << "hcms_bytes_written_total{op=\"" << METRIC_OP_NAMES[op] << "\"} " << bytesWritten[op].load(memory_order_relaxed) << "\n";
+    file << "# HELP hcms_bloom_checks_total Lookups that consulted a Bloom filter.\n";
+    file << "# TYPE hcms_bloom_checks_total counter\n";
+    for (int id = 0; id < BLOOM_COUNT; id++)
+        file << "hcms_bloom_checks_total{filter=\"" << BLOOM_NAMES[id] << "\"} " << bloomChecks[id].load(memory_order_relaxed) << "\n";
+    file << "# HELP hcms_bloom_negatives_total Lookups answered \"not found\" by the filter alone.\n";
+    file << "# TYPE hcms_bloom_negatives_total counter\n";
+    for (int id = 0; id < BLOOM_COUNT; id++)
+        file << "hcms_bloom_negatives_total{filter=\"" << BLOOM_NAMES[id] << "\"} " << bloomNegatives[id].load(memory_order_relaxed) << "\n";
+    file << "# HELP hcms_bloom_false_positives_total Filter hits that the index then missed.\n";
+    file << "# TYPE hcms_bloom_false_positives_total counter\n";
+    for (int id = 0; id < BLOOM_COUNT; id++)
+        file << "hcms_bloom_false_positives_total{filter=\"" << BLOOM_NAMES[id] << "\"} " << bloomFalsePositives[id].load(memory_order_relaxed) << "\n";
+    file.close();
+}
+
+// Records the lifetime of the enclosing scope against one operation.
+class ScopedTimer {
+    MetricOp op;
+    chrono::steady_clock::time_point start;
+public:
+    explicit ScopedTimer(MetricOp op) : op(op), start(chrono::steady_clock::now()) {}
+    ~ScopedTimer() {
+        auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+        metrics.record(op, (uint64_t)elapsed.count());
+    }
+};
+
+// Lookup a query runs, decided by its table, selected columns and key field.
+enum QueryAction {
+    QUERY_DOCTOR_BY_ID,
+    QUERY_DOCTOR_NAME_BY_ID,
+    QUERY_APPOINTMENT_BY_ID,
+    QUERY_APPOINTMENTS_BY_DOCTOR,
+    QUERY_COUNT_APPOINTMENTS_BY_DOCTOR,
+    QUERY_SCAN,  // filters no index can answer: full scan of the table
+    // appointments join doctors, by the kind of filter
+    QUERY_JOIN_BY_APPOINTMENT,
+    QUERY_JOIN_BY_DOCTOR,
+    QUERY_JOIN_BY_DOCTOR_NAME,
+    QUERY_JOIN_SCAN
+};
+
+enum QueryColumn {
+    COLUMN_ALL,
+    COLUMN_DOCTOR_NAME,
+    COLUMN_COUNT
+};
+
+// Parsed form of a query. A '?' in place of the quoted value is bound at execution,
+// so one plan serves every value of the same query shape.
+struct PreparedQuery {
+    QueryAction action;
+    QueryColumn column;
+    bool doctors = false;   // table, or for a join the table of the filtered field
+    bool join = false;      // appointments joined with their doctors on the doctor ID
+    int field = 0;          // '|'-separated position of the filtered field in a record
+    bool contains = false;  // substring match instead of equality
+    bool hasParameter = false;
+    string value;
+};
+
+// Matches a lowercase keyword at pos, ignoring case and any spaces in the query
+// (so "select doctor name" matches "selectdoctorname"), and moves pos past it.
+bool matchKeyword(string_view query, size_t& pos, string_view keyword) {
+    size_t p = pos;
+    for (char expected : keyword) {
+        while (p < query.size() && query[p] == ' ')
+            p++;
+        if (p >= query.size() || tolower((unsigned char)query[p]) != expected)
+            return false;
+        p++;
     }
+    pos = p;
     return true;
 }
 
+// Single pass over the query text. Returns nullptr on success, otherwise the reason
+// the query was rejected. "from appointments join doctors" (in either order) joins
+// on the doctor ID, and the where clause may then filter on a field of either table.
+const char* parseQuery(string_view query, PreparedQuery& plan) {
+    const char* const startError =
+        "Make sure the query starts with 'select * from', 'select doctor name from' or 'select count(*) from'.";
+    QueryColumn column;
+    size_t pos = 0;
+    if (!matchKeyword(query, pos, "select"))
+        return startError;
+    if (matchKeyword(query, pos, "*"))
+        column = COLUMN_ALL;
+    else if (matchKeyword(query, pos, "doctorname"))
+        column = COLUMN_DOCTOR_NAME;
+    else if (matchKeyword(query, pos, "count(*)"))
+        column = COLUMN_COUNT;
+    else
+        return startError;
+    if (!matchKeyword(query, pos, "from"))
+        return startError;
+    bool doctors = matchKeyword(query, pos, "doctors");
+    if (!doctors && !matchKeyword(query, pos, "appointments"))
+        return "Invalid table name.";
+    bool join = matchKeyword(query, pos, "join");
+    if (join && !matchKeyword(query, pos, doctors ? "appointments" : "doctors"))
+        return "Only appointments and doctors can be joined.";
+    if (!matchKeyword(query, pos, "where"))
+        return "where clause missing.";
+    int field;
+    bool indexed = false;
+    if (join) {
+        // doctorid is the join key and is read from the appointment side.
+        doctors = false;
+        if (matchKeyword(query, pos, "appointmentid")) {
+            field = 0;
+            indexed = true;
+        } else if (matchKeyword(query, pos, "date")) {
+            field = 1;
+        } else if (matchKeyword(query, pos, "doctorid")) {
+            field = 2;
+            indexed = true;
+        } else if (matchKeyword(query, pos, "doctorname") || matchKeyword(query, pos, "name")) {
+            doctors = true;
+            field = 1;
+            indexed = true;
+        } else if (matchKeyword(query, pos, "address")) {
+            doctors = true;
+            field = 2;
+        } else {
+            return "Invalid field name.";
+        }
+    } else if (doctors) {
+        if (matchKeyword(query, pos, "doctorid")) {
+            field = 0;
+            indexed = true;
+        } else if (matchKeyword(query, pos, "doctorname") || matchKeyword(query, pos, "name")) {
+            field = 1;
+        } else if (matchKeyword(query, pos, "address")) {
+            field = 2;
+        } else {
+            return "Invalid field name.";
+        }
+    } else {
+        if (matchKeyword(query, pos, "appointmentid")) {
+            field = 0;
+            indexed = true;
+        } else if (matchKeyword(query, pos, "date")) {
+            field = 1;
+        } else if (matchKeyword(query, pos, "doctorid")) {
+            field = 2;
+            indexed = true;
+        } else {
+            return "Invalid field name.";
+        }
+    }
+    if (matchKeyword(query, pos, "contains"))
+        plan.contains = true;
+    else if (!matchKeyword(query, pos, "="))
+        return "Missing '=' or 'contains' after the field name.";
+    if (matchKeyword(query, pos, "?")) {
+        plan.hasParameter = true;
+    } else {
+        if (!matchKeyword(query, pos, "'"))
+            return "Field value must be enclosed in single quotes.";
+        size_t closingQuote = query.find('\'', pos);
+        if (closingQuote == string_view::npos)
+            return "Unclosed quote.";
+        // Spaces around the value are dropped, as the original parser stripped them;
+        // inner spaces stay so names and timestamps can be matched.
+        string_view value = query.substr(pos, closingQuote - pos);
+        size_t first = value.find_first_not_of(' ');
+        if (first == string_view::npos)
+            return "Empty field value.";
+        plan.value = string(value.substr(first, value.find_last_not_of(' ') - first + 1));
+        pos = closingQuote + 1;
+    }
+    if (query.find_first_not_of(' ', pos) != string_view::npos)
+        return "Unexpected text after the field value.";
+
+    plan.column = column;
+    plan.doctors = doctors;
+    plan.join = join;
+    plan.field = field;
+    bool useIndex = indexed && !plan.contains;
+    if (join && useIndex && !doctors)
+        plan.action = field == 0 ? QUERY_JOIN_BY_APPOINTMENT : QUERY_JOIN_BY_DOCTOR;
+    else if (join && useIndex)
+        plan.action = QUERY_JOIN_BY_DOCTOR_NAME;
+    else if (join)
+        plan.action = QUERY_JOIN_SCAN;
+    else if (useIndex && doctors && column != COLUMN_COUNT)
+        plan.action = column == COLUMN_ALL ? QUERY_DOCTOR_BY_ID : QUERY_DOCTOR_NAME_BY_ID;
+    else if (useIndex && !doctors && column == COLUMN_COUNT && field == 2)
+        plan.action = QUERY_COUNT_APPOINTMENTS_BY_DOCTOR;
+    else if (useIndex && !doctors && column != COLUMN_COUNT)
+        plan.action = field == 0 ? QUERY_APPOINTMENT_BY_ID : QUERY_APPOINTMENTS_BY_DOCTOR;
+    else if (!doctors && column == COLUMN_DOCTOR_NAME)
+        return "Unsupported query.";
+    else
+        plan.action = QUERY_SCAN;
+    return nullptr;
+}
+
 template <typename T>
 int binarySearch(const vector<pair<T, int>>& index, const T& key) {
+    ScopedTimer timer(OP_BINARY_SEARCH);
     int low = 0, high = index.size() - 1;
     while (low <= high) {
         int mid = low + (high - low) / 2;
@@ -73,873 +427,4731 @@ int binarySearch(const vector<pair<T, int>>& index, const T& key) {
     }
     return -1;
 }
-struct DoctorNode {
-    string doctorID;
-    DoctorNode* next;
-};
-class LinkedList {
+
+// Sorted map held as a run of chunks of at most CHUNK_SIZE entries, each immutable and
+// shared. Copying the map copies only the chunk pointers and a change copies just the
+// chunk it touches, so an index can be snapshotted after every write at a cost of
+// size() / CHUNK_SIZE pointers, with each version sharing its unchanged chunks.
+template <typename Key, typename Value>
+class ChunkedMap {
 public:
-    DoctorNode* head;
-    LinkedList() : head(nullptr) {}
-    void insert(const string& doctorID) {
-       DoctorNode * newNode = new DoctorNode{doctorID, nullptr};
-        if (!head) {
-            head = newNode;
-            return;
+    using Entry = pair<Key, Value>;
+    static const size_t CHUNK_SIZE = 512;
+
+    class const_iterator {
+    public:
+        using iterator_category = forward_iterator_tag;
+        using value_type = Entry;
+        using difference_type = ptrdiff_t;
+        using pointer = const Entry*;
+        using reference = const Entry&;
+
+        const_iterator() = default;
+        const_iterator(const ChunkedMap* map, size_t chunk) : map(map), chunk(chunk) {}
+        reference operator*() const { return (*map->chunks[chunk])[offset]; }
+        pointer operator->() const { return &**this; }
+        const_iterator& operator++() {
+            if (++offset == map->chunks[chunk]->size()) {
+                chunk++;
+                offset = 0;
+            }
+            return *this;
         }
-        if (head->doctorID > doctorID) {
-            newNode->next = head;
-            head = newNode;
+        bool operator==(const const_iterator& other) const { return chunk == other.chunk && offset == other.offset; }
+        bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+    private:
+        const ChunkedMap* map = nullptr;
+        size_t chunk = 0;
+        size_t offset = 0;
+    };
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, chunks.size()); }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    const Value* find(const Key& key) const {
+        ScopedTimer timer(OP_BINARY_SEARCH);
+        size_t c = chunkFor(key);
+        if (c == chunks.size())
+            return nullptr;
+        auto it = lower_bound(chunks[c]->begin(), chunks[c]->end(), key, keyBelow);
+        return it != chunks[c]->end() && it->first == key ? &it->second : nullptr;
+    }
+
+    // Inserts key, or replaces its value.
+    void set(const Key& key, Value value) {
+        if (chunks.empty()) {
+            chunks.push_back(make_shared<const Chunk>(1, Entry(key, move(value))));
+            lastKeys.push_back(key);
+            count = 1;
             return;
         }
-        DoctorNode* current = head;
-        while (current->next && current->next->doctorID < doctorID) {
-            current = current->next;
+        size_t c = min(chunkFor(key), chunks.size() - 1);
+        auto chunk = make_shared<Chunk>(*chunks[c]);
+        auto it = lower_bound(chunk->begin(), chunk->end(), key, keyBelow);
+        if (it != chunk->end() && it->first == key) {
+            it->second = move(value);
+        } else {
+            chunk->insert(it, Entry(key, move(value)));
+            count++;
+        }
+        if (chunk->size() > CHUNK_SIZE) {
+            auto upper = make_shared<const Chunk>(chunk->begin() + chunk->size() / 2, chunk->end());
+            chunk->erase(chunk->begin() + chunk->size() / 2, chunk->end());
+            chunks.insert(chunks.begin() + c + 1, upper);
+            lastKeys.insert(lastKeys.begin() + c + 1, upper->back().first);
         }
-        newNode->next = current->next;
-        current->next = newNode;
+        lastKeys[c] = chunk->back().first;
+        chunks[c] = move(chunk);
     }
-    bool find(const string& doctorID) {
-        DoctorNode* current = head;
-        while (current) {
-            if (current->doctorID == doctorID)
-                return true;
-            current = current->next;
+
+    bool erase(const Key& key) {
+        size_t c = chunkFor(key);
+        if (c == chunks.size())
+            return false;
+        auto it = lower_bound(chunks[c]->begin(), chunks[c]->end(), key, keyBelow);
+        if (it == chunks[c]->end() || it->first != key)
+            return false;
+        count--;
+        if (chunks[c]->size() == 1) {
+            chunks.erase(chunks.begin() + c);
+            lastKeys.erase(lastKeys.begin() + c);
+            return true;
         }
-        return false;
+        auto chunk = make_shared<Chunk>(*chunks[c]);
+        chunk->erase(chunk->begin() + (it - chunks[c]->begin()));
+        lastKeys[c] = chunk->back().first;
+        chunks[c] = move(chunk);
+        return true;
     }
 
-    void remove(const string& doctorID) {
-        DoctorNode* current = head;
-        DoctorNode* prev = nullptr;
-        while (current) {
-            if (current->doctorID == doctorID) {
-                if (prev)
-                    prev->next = current->next;
-                else
-                    head = current->next;
-                delete current;
-                return;
-            }
-            prev = current;
-            current = current->next;
+    // Replaces the contents with entries, which are sorted by key and unique.
+    void assign(vector<Entry> entries) {
+        chunks.clear();
+        lastKeys.clear();
+        for (size_t begin = 0; begin < entries.size(); begin += CHUNK_SIZE) {
+            auto first = make_move_iterator(entries.begin() + begin);
+            auto last = make_move_iterator(entries.begin() + min(begin + CHUNK_SIZE, entries.size()));
+            chunks.push_back(make_shared<const Chunk>(first, last));
+            lastKeys.push_back(chunks.back()->back().first);
         }
+        count = entries.size();
     }
+
+private:
+    using Chunk = vector<Entry>;
+    vector<shared_ptr<const Chunk>> chunks;  // none empty
+    vector<Key> lastKeys;                    // last key of each chunk
+    size_t count = 0;
+
+    static bool keyBelow(const Entry& entry, const Key& key) { return entry.first < key; }
+    // The first chunk whose last key is not below key, or chunks.size().
+    size_t chunkFor(const Key& key) const { return lower_bound(lastKeys.begin(), lastKeys.end(), key) - lastKeys.begin(); }
 };
 
-class DoctorSecondaryIndex {
+// Dictionary of every ID and name held by the in-memory indexes. Each distinct string
+// is stored once and the indexes keep its dense 32-bit handle, so comparisons and
+// hashing inside an index are integer operations. Handles are never reused: a key
+// stays interned after its record is deleted and gets the same handle if it returns.
+// Text is packed into arena blocks and the per-handle entries live in chunks that
+// double in size; neither ever moves, so str() needs no lock while a writer interns.
+// Lookups go through an open-addressing table of atomic handle slots. Growing builds
+// a larger table and publishes it with an atomic pointer swap; superseded tables stay
+// allocated (together smaller than the current one) because a reader may still be
+// probing them. find() therefore takes no lock and never grows the pool; only intern()
+// serializes on poolMutex. Indexes sorted by handle are ordered by first appearance,
+// not alphabetically.
+typedef uint32_t StringHandle;
+
+class StringPool {
 public:
-    map<string, LinkedList> Index;
-    const string DOCTOR_SECONDARY_INDEX_FILE = "doctor_secondary.index";
+    static const StringHandle NONE = UINT32_MAX;
 
-    void Insert(const string& secondaryKey, const string& doctorID);
-    bool find(const string& secondaryKey, const string& doctorID);
-    void remove(const string& secondaryKey, const string& doctorID);
-    void load();
-    void save();
-};
+    StringHandle intern(string_view text);
+    StringHandle find(string_view text) const;
+    string_view str(StringHandle handle) const {
+        const Entry& e = entry(handle);
+        return string_view(e.data, e.length);
+    }
+    bool less(StringHandle a, StringHandle b) const { return str(a) < str(b); }
+    size_t size() const { return count.load(memory_order_acquire); }
+    size_t memoryUsage() const;
 
+private:
+    struct Entry {
+        const char* data;
+        uint32_t length;
+        uint32_t hash;
+    };
+    // Chunk k holds 2^(k + FIRST_CHUNK_BITS) entries, enough chunks for every handle.
+    static const int FIRST_CHUNK_BITS = 10;
+    static const int CHUNK_COUNT = 33 - FIRST_CHUNK_BITS;
+    static const size_t TEXT_BLOCK_SIZE = 64 * 1024;
 
-void DoctorSecondaryIndex::Insert(const string& secondaryKey, const string& doctorID) {
-    Index[secondaryKey].insert(doctorID);
-}
+    array<unique_ptr<Entry[]>, CHUNK_COUNT> chunks;
+    atomic<uint32_t> count{0};
+    vector<unique_ptr<char[]>> textBlocks;
+    size_t textUsed = TEXT_BLOCK_SIZE;
+    size_t textBytes = 0;
+    struct ProbeTable {
+        size_t mask;  // power-of-two size minus one; the table is at most half full
+        unique_ptr<atomic<StringHandle>[]> slots;
+    };
+    vector<unique_ptr<ProbeTable>> tables;  // every table built, the current one last
+    atomic<ProbeTable*> table{nullptr};
+    mutable mutex poolMutex;
 
-bool DoctorSecondaryIndex::find(const string& secondaryKey, const string& appointmentID) {
-    auto it = Index.find(secondaryKey);
-    if (it != Index.end()) {
-        return it->second.find(appointmentID);
+    static uint32_t hash(string_view text);
+    static int chunkOf(uint64_t biased) { return 63 - __builtin_clzll(biased) - FIRST_CHUNK_BITS; }
+    Entry& entry(StringHandle handle) const {
+        uint64_t biased = (uint64_t)handle + (1ULL << FIRST_CHUNK_BITS);
+        int chunk = chunkOf(biased);
+        return chunks[chunk][biased - (1ULL << (chunk + FIRST_CHUNK_BITS))];
     }
-    return false;
+    size_t probe(const ProbeTable& t, string_view text, uint32_t h) const;
+    const char* store(string_view text);
+    void grow();
+};
+
+uint32_t StringPool::hash(string_view text) {
+    uint32_t h = 2166136261u;  // FNV-1a
+    for (unsigned char c : text) {
+        h ^= c;
+        h *= 16777619u;
+    }
+    return h;
 }
 
-void DoctorSecondaryIndex::remove(const string& secondaryKey, const string& doctorID) {
-    LinkedList& doctorList = Index[secondaryKey];
-    doctorList.remove(doctorID);
-    if (doctorList.head == nullptr) {
-        Index.erase(secondaryKey);
+// Slot holding the handle for text, or the empty slot where it would go.
+// A handle is stored in its slot only after its entry is written, so the acquire load
+// makes the entry visible.
+size_t StringPool::probe(const ProbeTable& t, string_view text, uint32_t h) const {
+    for (size_t i = h & t.mask;; i = (i + 1) & t.mask) {
+        StringHandle handle = t.slots[i].load(memory_order_acquire);
+        if (handle == NONE)
+            return i;
+        const Entry& e = entry(handle);
+        if (e.hash == h && string_view(e.data, e.length) == text)
+            return i;
     }
 }
 
-void DoctorSecondaryIndex::load() {
-    fstream file(DOCTOR_SECONDARY_INDEX_FILE, ios::in);
-    if (file.is_open()) {
-        string line;
-        while (getline(file, line)) {
-            stringstream ss(line);
-            string name;
-            string doctorID;
-            getline(ss, name, '|');
-            while (getline(ss, doctorID, '|')) {
-                Insert(name, doctorID);
-            }
+// Long strings get a block of their own so they do not waste the tail of a shared one.
+const char* StringPool::store(string_view text) {
+    char* data;
+    if (text.size() > TEXT_BLOCK_SIZE / 4) {
+        textBlocks.emplace_back(new char[text.size()]);
+        textBytes += text.size();
+        data = textBlocks.back().get();
+        if (textBlocks.size() > 1)
+            textBlocks.back().swap(textBlocks[textBlocks.size() - 2]);  // keep the open block last
+    } else {
+        if (textUsed + text.size() > TEXT_BLOCK_SIZE) {
+            textBlocks.emplace_back(new char[TEXT_BLOCK_SIZE]);
+            textBytes += TEXT_BLOCK_SIZE;
+            textUsed = 0;
         }
-        file.close();
+        data = textBlocks.back().get() + textUsed;
+        textUsed += text.size();
     }
+    memcpy(data, text.data(), text.size());
+    return data;
 }
 
-void DoctorSecondaryIndex::save() {
-    fstream file(DOCTOR_SECONDARY_INDEX_FILE, ios::out | ios::trunc);
-    if (file.is_open()) {
-        for (const auto& entry : Index) {
-            file << entry.first;
-            DoctorNode* current = entry.second.head;
-            while (current) {
-                file << "|" << current->doctorID;
-                current = current->next;
-            }
-            file << "\n";
-        }
-        file.close();
+void StringPool::grow() {
+    ProbeTable* current = table.load(memory_order_relaxed);
+    size_t size = current ? (current->mask + 1) * 2 : 1024;
+    unique_ptr<ProbeTable> larger(new ProbeTable{size - 1, unique_ptr<atomic<StringHandle>[]>(new atomic<StringHandle>[size])});
+    for (size_t i = 0; i < size; i++)
+        larger->slots[i].store(NONE, memory_order_relaxed);
+    uint32_t handles = count.load(memory_order_relaxed);
+    for (StringHandle handle = 0; handle < handles; handle++) {
+        size_t i = entry(handle).hash & larger->mask;
+        while (larger->slots[i].load(memory_order_relaxed) != NONE)
+            i = (i + 1) & larger->mask;
+        larger->slots[i].store(handle, memory_order_relaxed);
     }
+    table.store(larger.get(), memory_order_release);
+    tables.push_back(move(larger));
 }
-//---------------------------------------------------
-struct AppointmentNode {
-    string appointmentID;
-    AppointmentNode* next;
 
-    AppointmentNode(const string& id, AppointmentNode* next = nullptr)
-        : appointmentID(id), next(next) {}
-};
-class AppointmentLinkedList {
-public:
-    AppointmentNode* head;
+StringHandle StringPool::intern(string_view text) {
+    StringHandle handle = find(text);
+    if (handle != NONE)
+        return handle;
+    lock_guard<mutex> lock(poolMutex);
+    handle = count.load(memory_order_relaxed);
+    ProbeTable* t = table.load(memory_order_relaxed);
+    if (!t || (size_t)(handle + 1) * 2 > t->mask + 1) {
+        grow();
+        t = table.load(memory_order_relaxed);
+    }
+    uint32_t h = hash(text);
+    size_t i = probe(*t, text, h);
+    StringHandle existing = t->slots[i].load(memory_order_relaxed);
+    if (existing != NONE)
+        return existing;
+    int chunk = chunkOf((uint64_t)handle + (1ULL << FIRST_CHUNK_BITS));
+    if (!chunks[chunk])
+        chunks[chunk].reset(new Entry[1ULL << (chunk + FIRST_CHUNK_BITS)]);
+    entry(handle) = {store(text), (uint32_t)text.size(), h};
+    count.store(handle + 1, memory_order_release);
+    t->slots[i].store(handle, memory_order_release);
+    return handle;
+}
 
-    AppointmentLinkedList() : head(nullptr) {}
+// Lock-free: probes whichever table is current. A string interned concurrently may
+// not be seen yet, as if the lookup had run just before it.
+StringHandle StringPool::find(string_view text) const {
+    const ProbeTable* t = table.load(memory_order_acquire);
+    if (!t)
+        return NONE;
+    return t->slots[probe(*t, text, hash(text))].load(memory_order_acquire);
+}
 
-    void insert(const string& appointmentID) {
-        AppointmentNode* newNode = new AppointmentNode(appointmentID, head);
-        head = newNode;
-    }
+// Approximate resident size: entry chunks, text blocks and the lookup tables.
+size_t StringPool::memoryUsage() const {
+    lock_guard<mutex> lock(poolMutex);
+    size_t entries = 0;
+    for (int chunk = 0; chunk < CHUNK_COUNT && chunks[chunk]; chunk++)
+        entries += 1ULL << (chunk + FIRST_CHUNK_BITS);
+    size_t slots = 0;
+    for (const auto& t : tables)
+        slots += t->mask + 1;
+    return entries * sizeof(Entry) + textBytes + slots * sizeof(atomic<StringHandle>);
+}
 
-    bool find(const string& appointmentID) {
-        AppointmentNode* current = head;
-        while (current) {
-            if (current->appointmentID == appointmentID)
-                return true;
-            current = current->next;
-        }
-        return false;
-    }
+StringPool stringPool;
 
-    void remove(const string& appointmentID) {
-        AppointmentNode* current = head;
-        AppointmentNode* prev = nullptr;
-        while (current) {
-            if (current->appointmentID == appointmentID) {
-                if (prev)
-                    prev->next = current->next;
-                else
-                    head = current->next;
-                delete current;
-                return;
-            }
-            prev = current;
-            current = current->next;
+// Calendar date parsed from the free-text appointment date ("YYYY-M-D" with an
+// optional " HH:MM"), kept together with how it was written so it can be re-created exactly.
+struct ParsedDate {
+    int days = 0;           // days since 1970-01-01
+    int minuteOfDay = -1;   // -1 when no time was given
+    bool padMonth = false;
+    bool padDay = false;
+};
+
+int daysFromCivil(int y, int m, int d) {
+    y -= m <= 2;
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+void civilFromDays(int z, int& y, int& m, int& d) {
+    z += 719468;
+    int era = (z >= 0 ? z : z - 146096) / 146097;
+    int doe = z - era * 146097;
+    int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp < 10 ? mp + 3 : mp - 9;
+    y = yoe + era * 400 + (m <= 2);
+}
+
+bool parseDate(const string& text, ParsedDate& date) {
+    int parts[3] = {0, 0, 0};
+    size_t widths[3] = {0, 0, 0};
+    size_t i = 0;
+    for (int part = 0; part < 3; part++) {
+        while (i < text.size() && isdigit((unsigned char)text[i]) && widths[part] < 4) {
+            parts[part] = parts[part] * 10 + (text[i] - '0');
+            widths[part]++;
+            i++;
         }
+        if (widths[part] == 0 || (part < 2 && (i >= text.size() || text[i++] != '-')))
+            return false;
     }
-};
+    if (widths[0] != 4 || widths[1] > 2 || widths[2] > 2 || parts[1] < 1 || parts[1] > 12 || parts[2] < 1)
+        return false;
+    date.days = daysFromCivil(parts[0], parts[1], parts[2]);
+    int y, m, d;
+    civilFromDays(date.days, y, m, d);
+    if (m != parts[1] || d != parts[2])
+        return false;  // e.g. 2023-2-30
+    date.padMonth = widths[1] == 2;
+    date.padDay = widths[2] == 2;
+    date.minuteOfDay = -1;
+    if (i == text.size())
+        return true;
+    int hour, minute;
+    char sep, colon;
+    if (text.size() - i != 6 || sscanf(text.c_str() + i, "%c%2d%c%2d", &sep, &hour, &colon, &minute) != 4 ||
+        sep != ' ' || colon != ':' || hour > 23 || minute > 59 || hour < 0 || minute < 0)
+        return false;
+    date.minuteOfDay = hour * 60 + minute;
+    return true;
+}
 
+string formatDate(const ParsedDate& date) {
+    int y, m, d;
+    civilFromDays(date.days, y, m, d);
+    stringstream ss;
+    ss << y << '-' << setfill('0') << setw(date.padMonth ? 2 : 1) << m << '-' << setw(date.padDay ? 2 : 1) << d;
+    if (date.minuteOfDay >= 0)
+        ss << ' ' << setw(2) << date.minuteOfDay / 60 << ':' << setw(2) << date.minuteOfDay % 60;
+    return ss.str();
+}
 
-class AppointmentSecondaryIndex {
+// Bloom filter kept in front of an index. Keys are never removed, so deletes only
+// leave stale bits behind; the filter is rebuilt from the index when it fills up
+// or when the persisted copy no longer matches the index it was saved with.
+// Bits are set with atomic ORs so a writer can add keys while readers probe.
+class BloomFilter {
 public:
-    map<string, AppointmentLinkedList> Index;
-    const string APPOINTMENT_SECONDARY_INDEX_FILE = "appointment_secondary.index";
+    explicit BloomFilter(double falsePositiveRate = 0.01) : falsePositiveRate(falsePositiveRate) {}
 
-    void insert(const string& doctorID, const string& appointmentID);
-    void remove(const string& doctorID, const string& appointmentID);
-    bool find(const string& doctorID, const string& appointmentID);
-    void load();
-    void save();
+    void reset(size_t expectedKeys, double rate);
+    void add(string_view key);
+    bool mightContain(string_view key) const;
+    bool needsRebuild(size_t liveKeys) const;
+    size_t keyCount() const { return inserted; }
+    bool load(const string& fileName);
+    void save(const string& fileName) const;
+
+    double falsePositiveRate;
+private:
+    vector<atomic<uint64_t>> bits;
+    uint64_t bitCount = 0;
+    int hashCount = 0;
+    size_t capacity = 0;
+    size_t inserted = 0;
+
+    static void hash(string_view key, uint64_t& h1, uint64_t& h2);
 };
 
-void AppointmentSecondaryIndex::insert(const string& doctorID, const string& appointmentID) {
-    if (Index.find(doctorID) == Index.end()) {
-        Index[doctorID] = AppointmentLinkedList();
+void BloomFilter::hash(string_view key, uint64_t& h1, uint64_t& h2) {
+    uint64_t h = 14695981039346656037ULL;  // FNV-1a
+    for (unsigned char c : key) {
+        h ^= c;
+        h *= 1099511628211ULL;
     }
-    Index[doctorID].insert(appointmentID);
+    h1 = h;
+    h ^= h >> 33;  // splitmix finalizer for the second, independent hash
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h2 = h | 1;
 }
 
-void AppointmentSecondaryIndex::remove(const string& doctorID, const string& appointmentID) {
-    auto it = Index.find(doctorID);
-    if (it != Index.end()) {
-        it->second.remove(appointmentID);
-        if (it->second.head == nullptr) {
-            Index.erase(it);
-        }
+void BloomFilter::reset(size_t expectedKeys, double rate) {
+    falsePositiveRate = rate;
+    capacity = max<size_t>(expectedKeys * 2, 64);  // leave room to grow before the next rebuild
+    double ln2 = 0.6931471805599453;
+    bitCount = (uint64_t)(-(double)capacity * log(falsePositiveRate) / (ln2 * ln2)) + 1;
+    hashCount = max(1, (int)lround((double)bitCount / capacity * ln2));
+    vector<atomic<uint64_t>> fresh((bitCount + 63) / 64);
+    bits.swap(fresh);
+    inserted = 0;
+}
+
+void BloomFilter::add(string_view key) {
+    if (bitCount == 0)
+        reset(0, falsePositiveRate);
+    uint64_t h1, h2;
+    hash(key, h1, h2);
+    for (int i = 0; i < hashCount; i++) {
+        uint64_t bit = (h1 + i * h2) % bitCount;
+        bits[bit / 64].fetch_or(1ULL << (bit % 64), memory_order_relaxed);
     }
+    inserted++;
 }
 
-bool AppointmentSecondaryIndex::find(const string& doctorID, const string& appointmentID) {
-    auto it = Index.find(doctorID);
-    if (it != Index.end()) {
-        return it->second.find(appointmentID);
+bool BloomFilter::mightContain(string_view key) const {
+    if (bitCount == 0)
+        return false;
+    uint64_t h1, h2;
+    hash(key, h1, h2);
+    for (int i = 0; i < hashCount; i++) {
+        uint64_t bit = (h1 + i * h2) % bitCount;
+        if (!(bits[bit / 64].load(memory_order_relaxed) & (1ULL << (bit % 64))))
+            return false;
     }
-    return false;
+    return true;
 }
 
-void AppointmentSecondaryIndex::load() {
-    fstream file(APPOINTMENT_SECONDARY_INDEX_FILE, ios::in);
-    if (file.is_open()) {
-        string line;
-        while (getline(file, line)) {
-            stringstream ss(line);
-            string doctorID, appointmentID;
-            getline(ss, doctorID, '|');
-            while (getline(ss, appointmentID, '|')) {
-                insert(doctorID, appointmentID);
-            }
-        }
-        file.close();
+// True when the filter may be missing keys, is over capacity, or is mostly stale bits.
+bool BloomFilter::needsRebuild(size_t liveKeys) const {
+    return bitCount == 0 || inserted < liveKeys || inserted > capacity || inserted > liveKeys * 2 + 64;
+}
+
+bool BloomFilter::load(const string& fileName) {
+    ifstream file(fileName, ios::in);
+    if (!file)
+        return false;
+    double rate;
+    uint64_t storedBits;
+    int storedHashes;
+    size_t storedCapacity, storedInserted;
+    if (!(file >> rate >> storedBits >> storedHashes >> storedCapacity >> storedInserted))
+        return false;
+    if (rate != falsePositiveRate || storedBits == 0)
+        return false;  // configured rate changed, rebuild with the new sizing
+    vector<uint64_t> words((storedBits + 63) / 64);
+    for (uint64_t& word : words) {
+        if (!(file >> hex >> word))
+            return false;
     }
+    vector<atomic<uint64_t>> loadedBits(words.size());
+    for (size_t i = 0; i < words.size(); i++)
+        loadedBits[i].store(words[i], memory_order_relaxed);
+    bits.swap(loadedBits);
+    bitCount = storedBits;
+    hashCount = storedHashes;
+    capacity = storedCapacity;
+    inserted = storedInserted;
+    metrics.addBytesRead(OP_LOAD_INDEXES, bits.size() * sizeof(uint64_t));
+    return true;
 }
 
-void AppointmentSecondaryIndex::save() {
-    fstream file(APPOINTMENT_SECONDARY_INDEX_FILE, ios::out | ios::trunc);
-    if (file.is_open()) {
-        for (const auto& entry : Index) {
-            file << entry.first;  // Doctor ID
-            AppointmentNode* current = entry.second.head;
-            while (current) {
-                file << "|" << current->appointmentID;  // Appointment ID
-                current = current->next;
-            }
-            file << "\n";
-        }
-        file.close();
+void BloomFilter::save(const string& fileName) const {
+    ofstream file(fileName, ios::out | ios::trunc);
+    if (!file) {
+        cerr << "Error: Unable to open " << fileName << " for writing." << endl;
+        return;
     }
+    file << setprecision(17) << falsePositiveRate << " " << bitCount << " " << hashCount << " " << capacity << " " << inserted << "\n";
+    file << hex;
+    for (const auto& word : bits)
+        file << word.load(memory_order_relaxed) << "\n";
+    metrics.addBytesWritten(OP_SAVE_INDEXES, (uint64_t)file.tellp());
+    file.close();
 }
 
+// Record layouts, declared as types: the fields in storage order with their maximum
+// widths, the primary key and the fields that have a secondary index. Record<Schema>
+// generates parsing, serialization and validation from the schema, and fields are
+// addressed by compile-time index (record.get<DoctorSchema::NAME>()).
+struct DoctorSchema {
+    enum Field { ID, NAME, ADDRESS, FIELD_COUNT };
+    static constexpr size_t WIDTHS[FIELD_COUNT] = {15, 30, 30};
+    static constexpr Field KEY = ID;
+    static constexpr Field SECONDARY_KEYS[] = {NAME};
+};
 
-class HealthcareManagementSystem {
+struct AppointmentSchema {
+    enum Field { ID, DATE, DOCTOR_ID, FIELD_COUNT };
+    static constexpr size_t WIDTHS[FIELD_COUNT] = {15, 30, 15};
+    static constexpr Field KEY = ID;
+    static constexpr Field SECONDARY_KEYS[] = {DOCTOR_ID};
+};
+
+struct PatientSchema {
+    enum Field { ID, NAME, PHONE, ADDRESS, FIELD_COUNT };
+    static constexpr size_t WIDTHS[FIELD_COUNT] = {15, 30, 15, 30};
+    static constexpr Field KEY = ID;
+    static constexpr Field SECONDARY_KEYS[] = {NAME};
+};
+
+// Links an appointment to the patient it is for; the secondary index on PATIENT_ID is
+// the patient -> appointments index.
+struct PatientAppointmentSchema {
+    enum Field { APPOINTMENT_ID, PATIENT_ID, FIELD_COUNT };
+    static constexpr size_t WIDTHS[FIELD_COUNT] = {15, 15};
+    static constexpr Field KEY = APPOINTMENT_ID;
+    static constexpr Field SECONDARY_KEYS[] = {PATIENT_ID};
+};
+
+template <typename Schema>
+class Record {
+public:
+    static constexpr size_t FIELD_COUNT = Schema::FIELD_COUNT;
+    array<string, FIELD_COUNT> fields;
+
+    template <typename Schema::Field F>
+    const string& get() const { return field<F>(fields); }
+    template <typename Schema::Field F>
+    string& get() { return field<F>(fields); }
+    const string& key() const { return get<Schema::KEY>(); }
+
+    // Splits "field|field|..." (no length prefix); the last field takes the rest of the
+    // text. Returns false when the text has fewer fields than the schema, leaving the
+    // missing ones empty.
+    static bool parse(string_view text, Record& record) {
+        size_t pos = 0;
+        return record.parseFields(text, pos, make_index_sequence<FIELD_COUNT>());
+    }
+    static Record parse(string_view text) {
+        Record record;
+        parse(text, record);
+        return record;
+    }
+    // Parses a line of the data file, which starts with the four-digit record length.
+    // Fields are split on the whole line and the prefix is then dropped from the first.
+    static Record fromStored(string_view stored) {
+        Record record = parse(stored);
+        string& first = std::get<0>(record.fields);
+        first.erase(0, min<size_t>(4, first.size()));
+        return record;
+    }
+
+    string serialize() const { return join(make_index_sequence<FIELD_COUNT>()); }
+    // The record as written to the data file, length prefix included.
+    string stored() const {
+        string text = serialize();
+        stringstream ss;
+        ss << setw(4) << setfill('0') << text.length() << text;
+        return ss.str();
+    }
+
+    // Returns nullptr when the record can be stored, otherwise the reason it cannot.
+    const char* validate() const {
+        if (!fitsWidths(make_index_sequence<FIELD_COUNT>()))
+            return "Error: Input exceeds the maximum allowed length.";
+        if (!separatorFree(make_index_sequence<FIELD_COUNT>()))
+            return "Error: Fields cannot contain '|' or line breaks.";
+        if (key().empty())
+            return "Error: ID cannot be empty.";
+        return nullptr;
+    }
+
+private:
+    template <typename Schema::Field F, typename Fields>
+    static auto& field(Fields& values) {
+        static_assert(F < FIELD_COUNT, "field is not part of the schema");
+        return std::get<F>(values);
+    }
+
+    template <size_t... I>
+    bool parseFields(string_view text, size_t& pos, index_sequence<I...>) {
+        bool complete = true;
+        ((complete = complete && takeField<I>(text, pos)), ...);
+        return complete;
+    }
+
+    template <size_t I>
+    bool takeField(string_view text, size_t& pos) {
+        if (pos > text.size())
+            return false;
+        size_t end = I + 1 == FIELD_COUNT ? string_view::npos : text.find('|', pos);
+        field<(typename Schema::Field)I>(fields) = string(text.substr(pos, end == string_view::npos ? string_view::npos : end - pos));
+        pos = end == string_view::npos ? text.size() + 1 : end + 1;
+        return end != string_view::npos || I + 1 == FIELD_COUNT;
+    }
 
-    vector<pair<string, int>> doctorPrimaryIndex;
-    vector<pair<string, int>> appointmentPrimaryIndex;
-    DoctorSecondaryIndex doctorSecondaryIndex;
-    AppointmentSecondaryIndex appointmentSecondaryIndex;
-    vector<int> doctorAvailList;
-    vector<int> appointmentAvailList;
+    template <size_t... I>
+    string join(index_sequence<I...>) const {
+        string text;
+        ((text += (I == 0 ? "" : "|"), text += std::get<I>(fields)), ...);
+        return text;
+    }
+
+    template <size_t... I>
+    bool fitsWidths(index_sequence<I...>) const {
+        return ((std::get<I>(fields).length() <= Schema::WIDTHS[I]) && ...);
+    }
+
+    template <size_t... I>
+    bool separatorFree(index_sequence<I...>) const {
+        return ((std::get<I>(fields).find_first_of("|\n") == string::npos) && ...);
+    }
+};
 
-    const string DOCTOR_FILE = "doctors.txt";
-    const string DOCTOR_INDEX_FILE = "doctor.index";
-    const string APPOINTMENT_FILE = "appointments.txt";
-    const string APPOINTMENT_INDEX_FILE = "appointment.index";
+using DoctorRecord = Record<DoctorSchema>;
+using AppointmentRecord = Record<AppointmentSchema>;
+using PatientRecord = Record<PatientSchema>;
+using PatientAppointmentRecord = Record<PatientAppointmentSchema>;
 
-    string readRecordFromFile(const string& fileName, int position);
-    int static findAvailableSlot(vector<int>& availList, const string& fileName);
-    void markDeleted(vector<int>& availList, int position, const string& fileName);
-    string extractField(const string& record, int fieldIndex);
+// Index maps are ChunkedMaps so a snapshot shares every chunk a write did not touch;
+// posting lists are immutable and shared the same way, replaced whole on change.
+using PrimaryIndex = ChunkedMap<StringHandle, int>;
+using PostingList = shared_ptr<const vector<StringHandle>>;
+using Postings = ChunkedMap<StringHandle, PostingList>;
 
+// Secondary index on field F of a schema: each value maps to the keys of the rows
+// holding it, as StringPool handles, with every posting list in key text order.
+// Table<Schema> keeps one per secondary key of its schema, each in its own file.
+// Lines are value|key|key...
+template <typename Schema, typename Schema::Field F>
+class SecondaryIndex {
 public:
-    void displayMenu();
-    void addDoctor(const string& doctorID, const string& name, const string& address);
-    void addAppointment(const string& appointmentID, const string& doctorID, const string& date);
-    void updateDoctor();
-    void updateAppointment();
-    void searchNameForQuary(string doctorID);
-    void deleteDoctor();
-    void deleteAppointment();
-    void searchDoctorByID(string doctorID);
-    void searchDoctorByName();
-    void searchAppointmentsByID(string arg);
-    void searchAppointmentsByDoctorID(string arg);
-    void loadIndexes();
-    void saveIndexes();
-    void loadAvailList(vector<int>& availList, const string& fileName);
-    void saveAvailList(const vector<int>& availList, const string& fileName);
-    void processQuery(const string& query);
+    using Row = Record<Schema>;
+    Postings postings;
+
+    void add(const Row& row) { add(row.template get<F>(), row.key()); }
+    void remove(const Row& row) { remove(row.template get<F>(), row.key()); }
+    void add(const string& value, const string& key);
+    void remove(const string& value, const string& key);
+    // Detaches and returns the posting list of value.
+    vector<StringHandle> take(const string& value);
+    void load(const string& fileName);
+    void save(const string& fileName) const;
 
+private:
+    static bool byText(StringHandle a, StringHandle b) { return stringPool.less(a, b); }
 };
 
-void HealthcareManagementSystem::displayMenu() {
-    cout << "\n--- Healthcare Management System ---\n";
-    cout << "1. Add New Doctor\n";
-    cout << "2. Add New Appointment\n";
-    cout << "3. Update Doctor Name\n";
-    cout << "4. Update Appointment Date\n";
-    cout << "5. Delete Doctor\n";
-    cout << "6. Delete Appointment\n";
-    cout << "7. Search Doctor by ID\n";
-    cout << "8. Search Doctor by Name\n";
-    cout << "9. Search Appointments by Appointment ID\n";
-    cout << "10. Search Appointments by Doctor ID\n";
-    cout << "11. Write Quary\n";
-    cout << "12. Exit\n";
-    cout << "Enter your choice: ";
+template <typename Schema, typename Schema::Field F>
+void SecondaryIndex<Schema, F>::add(const string& value, const string& key) {
+    StringHandle handle = stringPool.intern(key);
+    StringHandle valueHandle = stringPool.intern(value);
+    const PostingList* current = postings.find(valueHandle);
+    auto keys = current ? make_shared<vector<StringHandle>>(**current) : make_shared<vector<StringHandle>>();
+    keys->insert(lower_bound(keys->begin(), keys->end(), handle, byText), handle);
+    postings.set(valueHandle, move(keys));
 }
-string HealthcareManagementSystem::readRecordFromFile(const string& fileName, int position) {
-    fstream file(fileName, ios::in);
-    file.seekg(position, ios::beg);
-    string record;
-    getline(file, record);
-    if (!record.empty() && record.back() == '*')
-        record = record.substr(0, record.length() - 1);
-    file.close();
-    return record;
+
+template <typename Schema, typename Schema::Field F>
+void SecondaryIndex<Schema, F>::remove(const string& value, const string& key) {
+    StringHandle valueHandle = stringPool.find(value);
+    const PostingList* current = postings.find(valueHandle);
+    if (!current)
+        return;
+    auto keys = make_shared<vector<StringHandle>>(**current);
+    keys->erase(std::remove(keys->begin(), keys->end(), stringPool.find(key)), keys->end());
+    if (keys->empty())
+        postings.erase(valueHandle);
+    else
+        postings.set(valueHandle, move(keys));
 }
 
-int HealthcareManagementSystem::findAvailableSlot(vector<int>& availList, const string& fileName) {
-    if (!availList.empty()) {
-        int position = availList.back();
-        availList.pop_back();
-        return position;
-    }
-    return -1;
+template <typename Schema, typename Schema::Field F>
+vector<StringHandle> SecondaryIndex<Schema, F>::take(const string& value) {
+    StringHandle valueHandle = stringPool.find(value);
+    const PostingList* current = postings.find(valueHandle);
+    if (!current)
+        return {};
+    vector<StringHandle> keys = **current;
+    postings.erase(valueHandle);
+    return keys;
 }
 
-void HealthcareManagementSystem::markDeleted(vector<int>& availList, int position, const string& fileName) {
-    availList.push_back(position);
-    fstream file(fileName, ios::in | ios::out);
-    file.seekp(position, ios::beg);
-    string record = readRecordFromFile(fileName, position);
-    if (!record.empty()) {
-        file.seekp(position + record.length() - 1, ios::beg);
-        file.put('*');
+// Lists written by save are already in order; older files are sorted once.
+template <typename Schema, typename Schema::Field F>
+void SecondaryIndex<Schema, F>::load(const string& fileName) {
+    map<StringHandle, vector<StringHandle>> lists;
+    ifstream file(fileName, ios::in);
+    string line;
+    while (getline(file, line)) {
+        metrics.addBytesRead(OP_LOAD_INDEXES, line.length() + 1);
+        string_view text = line;
+        size_t end = text.find('|');
+        vector<StringHandle>& keys = lists[stringPool.intern(text.substr(0, end))];
+        while (end != string_view::npos) {
+            size_t start = end + 1;
+            end = text.find('|', start);
+            keys.push_back(stringPool.intern(text.substr(start, end == string_view::npos ? string_view::npos : end - start)));
+        }
     }
-    file.close();
+    vector<Postings::Entry> entries;
+    entries.reserve(lists.size());
+    for (auto& list : lists) {
+        if (!is_sorted(list.second.begin(), list.second.end(), byText))
+            sort(list.second.begin(), list.second.end(), byText);
+        entries.emplace_back(list.first, make_shared<const vector<StringHandle>>(move(list.second)));
+    }
+    postings.assign(move(entries));
 }
 
-void HealthcareManagementSystem::addDoctor(const string& doctorID, const string& name, const string& address) {
-    if (doctorID.length() > 15 || name.length() > 30 || address.length() > 30) {
-        cout << "Error: Input exceeds the maximum allowed length.\n";
+template <typename Schema, typename Schema::Field F>
+void SecondaryIndex<Schema, F>::save(const string& fileName) const {
+    ofstream file(fileName, ios::out | ios::trunc);
+    if (!file) {
+        cerr << "Error: Unable to open " << fileName << " for writing." << endl;
         return;
     }
-    if (binarySearch(doctorPrimaryIndex, doctorID) != -1) {
-        cout << "Doctor with this ID already exists.\n";
-        return;
+    for (const auto& entry : postings) {
+        file << stringPool.str(entry.first);
+        for (StringHandle key : *entry.second)
+            file << "|" << stringPool.str(key);
+        file << "\n";
     }
-    string fullRecord = doctorID + "|" + name + "|" + address;
-    int recordLength = fullRecord.length();
-    int position = -1;
-    if (!doctorAvailList.empty()) {
-        int availablePosition = doctorAvailList.back();
-        string existingRecord = readRecordFromFile(DOCTOR_FILE, availablePosition);
-        int existingRecordLength = stoi(existingRecord.substr(0, 4));
-        if (existingRecordLength >= recordLength) {
-            position = availablePosition;
-            doctorAvailList.pop_back();
+    metrics.addBytesWritten(OP_SAVE_INDEXES, (uint64_t)file.tellp());
+}
+
+// File-backed table for a schema: a data file of length-prefixed records with '*'
+// tombstones and an avail list of freed slots, a sorted primary index and one
+// secondary index per secondary key. It is the storage engine under the doctors,
+// appointments, patients and appointment links.
+//
+// find/keysBy/insert/update/remove are self-contained and synchronized by the table.
+// The storage calls below them leave synchronization to the caller, which layers its
+// own structures on top: the doctor and appointment tables hold freed slots back until
+// no snapshot can read them (deferSlotReuse), and appointment positions below zero are
+// block store refs that the table stores but never dereferences. With deferred reuse a
+// record is never written over while a snapshot may still read it: updates go to a
+// new slot and the old one is tombstoned only when it is handed back for reuse.
+// Mutations are not persisted until save().
+template <typename Schema>
+class Table {
+public:
+    using Row = Record<Schema>;
+    static constexpr size_t SECONDARY_COUNT = sizeof(Schema::SECONDARY_KEYS) / sizeof(Schema::SECONDARY_KEYS[0]);
+
+    const string DATA_FILE;
+    const string INDEX_FILE;
+    const string AVAIL_FILE;
+
+    Table(const string& dataFile, const string& fileStem, bool deferSlotReuse = false)
+        : DATA_FILE(dataFile), INDEX_FILE(fileStem + ".index"), AVAIL_FILE(fileStem + ".avail"),
+          FILE_STEM(fileStem), deferSlotReuse(deferSlotReuse) {}
+
+    void load();
+    // pendingSlots are freed slots the owner still holds back; after a restart nothing
+    // can read them, so they are saved as available.
+    void save(const vector<int>& pendingSlots = {});
+    bool find(const string& key, Row& row) const;
+    // Keys of the rows whose field F equals value; F must be a secondary key.
+    template <typename Schema::Field F>
+    vector<string> keysBy(const string& value) const;
+    const char* insert(const Row& row);
+    const char* update(const Row& row);
+    bool remove(const string& key);
+    size_t size() const;
+
+    // Storage layer; callers synchronize, and never pass negative positions here.
+    const PrimaryIndex& positions() const { return primary; }
+    const int* position(string_view key) const;
+    void setPosition(string_view key, int position);
+    bool erasePosition(string_view key);
+    // Replaces the whole primary index; entries are sorted by key.
+    void setPositions(vector<PrimaryIndex::Entry> entries) { primary.assign(move(entries)); }
+    template <typename Schema::Field F>
+    SecondaryIndex<Schema, F>& secondaryIndex() { return std::get<secondarySlot<F>()>(secondary); }
+    template <typename Schema::Field F>
+    const SecondaryIndex<Schema, F>& secondaryIndex() const { return std::get<secondarySlot<F>()>(secondary); }
+    // Owner metadata saved at the top of the index file as #name|value lines.
+    string tag(const string& name) const;
+    void setTag(const string& name, const string& value) { tags[name] = value; }
+    string readLine(int position) const;
+    // Reads many records through one handle in offset order, as (position, line) pairs.
+    vector<pair<int, string>> readLines(vector<int> positions) const;
+    // Writes a record into the most recently freed slot that is long enough, else at
+    // the end of the file. Returns its position, or -1 when the file cannot be written.
+    int write(const Row& row);
+    // Writes row elsewhere and releases the old slot, or rewrites it in place when the
+    // length is unchanged and slots are not deferred. Returns the new position, or -1.
+    int rewrite(int position, const Row& row);
+    // Tombstones the records at positions and frees their slots. A table with deferred
+    // slot reuse leaves the records intact and keeps the slots until the owner collects
+    // them with takeFreedSlots() and hands them back with reuseSlots(), which tombstones
+    // them. Returns false, changing nothing, when the data file cannot be opened.
+    bool release(vector<int> positions);
+    vector<int> takeFreedSlots() { return exchange(freed, {}); }
+    void reuseSlots(const vector<int>& positions);
+
+private:
+    template <size_t... I>
+    static auto secondaryIndexes(index_sequence<I...>) { return tuple<SecondaryIndex<Schema, Schema::SECONDARY_KEYS[I]>...>(); }
+
+    const string FILE_STEM;
+    const bool deferSlotReuse;
+    // Keys are StringPool handles.
+    PrimaryIndex primary;
+    decltype(secondaryIndexes(make_index_sequence<SECONDARY_COUNT>())) secondary;
+    map<string, string> tags;
+    vector<int> avail;
+    vector<int> freed;
+    mutable shared_mutex tableMutex;
+
+    template <typename Schema::Field F>
+    static constexpr size_t secondarySlot() {
+        for (size_t i = 0; i < SECONDARY_COUNT; i++) {
+            if (Schema::SECONDARY_KEYS[i] == F)
+                return i;
         }
+        return SECONDARY_COUNT;
     }
-    if(position == -1 && doctorPrimaryIndex.empty()) {
-        position=0;
+    // stem_secondary.index for the first secondary key, stem_secondaryN.index after it.
+    string secondaryIndexFile(size_t slot) const {
+        return FILE_STEM + "_secondary" + (slot == 0 ? "" : to_string(slot)) + ".index";
     }
-    if (position == -1) {
-        fstream doctorFile(DOCTOR_FILE, ios::in | ios::out | ios::app);
-        if (!doctorFile) {
-            cerr << "Error opening doctors.txt!" << endl;
-            return;
-        }
-        doctorFile.seekp(0, ios::end);
-        position = doctorFile.tellp();
-        doctorFile.close();
-    }
-    fstream doctorFile(DOCTOR_FILE, ios::in | ios::out);
-    doctorFile.seekp(position, ios::beg);
-    stringstream ss;
-    ss << setw(4) << setfill('0') << recordLength;
-    string fixedLength = ss.str();
-    doctorFile << fixedLength << fullRecord<<'\n';
-    doctorFile.close();
-    doctorPrimaryIndex.push_back({doctorID, position});
-    sort(doctorPrimaryIndex.begin(), doctorPrimaryIndex.end());
-
-    doctorSecondaryIndex.Insert(name, doctorID);
-    saveIndexes();
-    doctorSecondaryIndex.save();
+    template <size_t... I>
+    void indexRow(const Row& row, bool add, index_sequence<I...>);
+    // Tombstones the records at positions, skipping any already tombstoned, and
+    // returns the slots it freed; false when the data file cannot be opened.
+    bool tombstone(vector<int> positions, vector<int>& freedSlots);
+    template <size_t... I>
+    void loadSecondary(index_sequence<I...>) { (std::get<I>(secondary).load(secondaryIndexFile(I)), ...); }
+    template <size_t... I>
+    void saveSecondary(index_sequence<I...>) const { (std::get<I>(secondary).save(secondaryIndexFile(I)), ...); }
+};
 
-    cout << "Doctor added successfully.\n";
+template <typename Schema>
+void Table<Schema>::load() {
+    unique_lock<shared_mutex> lock(tableMutex);
+    vector<PrimaryIndex::Entry> entries;
+    tags.clear();
+    avail.clear();
+    freed.clear();
+    ifstream indexFile(INDEX_FILE, ios::in);
+    string line;
+    while (getline(indexFile, line)) {
+        metrics.addBytesRead(OP_LOAD_INDEXES, line.length() + 1);
+        size_t delim = line.rfind('|');
+        if (delim == string::npos)
+            continue;
+        if (line[0] == '#')
+            tags[line.substr(1, delim - 1)] = line.substr(delim + 1);
+        else
+            entries.push_back({stringPool.intern(string_view(line).substr(0, delim)), atoi(line.c_str() + delim + 1)});
+    }
+    sort(entries.begin(), entries.end());
+    primary.assign(move(entries));
+    loadSecondary(make_index_sequence<SECONDARY_COUNT>());
+    ifstream availFile(AVAIL_FILE, ios::in);
+    while (getline(availFile, line)) {
+        metrics.addBytesRead(OP_LOAD_INDEXES, line.length() + 1);
+        if (!line.empty())
+            avail.push_back(atoi(line.c_str()));
+    }
+    // Deferred slots are saved before they are tombstoned; nothing can read them now.
+    vector<int> marked;
+    if (deferSlotReuse)
+        tombstone(avail, marked);
 }
 
+// Lines are #tag|value, then key|position; one freed position per line in the avail file.
+template <typename Schema>
+void Table<Schema>::save(const vector<int>& pendingSlots) {
+    shared_lock<shared_mutex> lock(tableMutex);
+    ofstream indexFile(INDEX_FILE, ios::out | ios::trunc);
+    ofstream availFile(AVAIL_FILE, ios::out | ios::trunc);
+    if (!indexFile || !availFile) {
+        cerr << "Error: Unable to open " << (indexFile ? AVAIL_FILE : INDEX_FILE) << " for writing." << endl;
+        return;
+    }
+    for (const auto& entry : tags)
+        indexFile << "#" << entry.first << "|" << entry.second << "\n";
+    for (const auto& entry : primary)
+        indexFile << stringPool.str(entry.first) << "|" << entry.second << "\n";
+    saveSecondary(make_index_sequence<SECONDARY_COUNT>());
+    for (const vector<int>* slots : initializer_list<const vector<int>*>{&avail, &freed, &pendingSlots}) {
+        for (int position : *slots)
+            availFile << position << "\n";
+    }
+    metrics.addBytesWritten(OP_SAVE_INDEXES, (uint64_t)indexFile.tellp() + availFile.tellp());
+}
 
-void HealthcareManagementSystem::deleteDoctor() {
+template <typename Schema>
+bool Table<Schema>::find(const string& key, Row& row) const {
+    shared_lock<shared_mutex> lock(tableMutex);
+    const int* pos = position(key);
+    if (!pos)
+        return false;
+    row = Row::fromStored(readLine(*pos));
+    return true;
+}
+
+template <typename Schema>
+template <typename Schema::Field F>
+vector<string> Table<Schema>::keysBy(const string& value) const {
+    constexpr size_t slot = secondarySlot<F>();
+    static_assert(slot < SECONDARY_COUNT, "field has no secondary index");
+    shared_lock<shared_mutex> lock(tableMutex);
+    vector<string> keys;
+    if (const PostingList* list = std::get<slot>(secondary).postings.find(stringPool.find(value))) {
+        for (StringHandle key : **list)
+            keys.emplace_back(stringPool.str(key));
+    }
+    return keys;
+}
+
+template <typename Schema>
+const char* Table<Schema>::insert(const Row& row) {
+    if (const char* error = row.validate())
+        return error;
+    unique_lock<shared_mutex> lock(tableMutex);
+    if (position(row.key()))
+        return "Error: A record with this ID already exists.";
+    int written = write(row);
+    if (written < 0)
+        return "Error: Unable to write the record.";
+    setPosition(row.key(), written);
+    indexRow(row, true, make_index_sequence<SECONDARY_COUNT>());
+    return nullptr;
+}
+
+template <typename Schema>
+const char* Table<Schema>::update(const Row& row) {
+    if (const char* error = row.validate())
+        return error;
+    unique_lock<shared_mutex> lock(tableMutex);
+    const int* pos = position(row.key());
+    if (!pos)
+        return "Error: Record not found.";
+    Row old = Row::fromStored(readLine(*pos));
+    int written = rewrite(*pos, row);
+    if (written < 0)
+        return "Error: Unable to write the record.";
+    setPosition(row.key(), written);
+    indexRow(old, false, make_index_sequence<SECONDARY_COUNT>());
+    indexRow(row, true, make_index_sequence<SECONDARY_COUNT>());
+    return nullptr;
+}
+
+template <typename Schema>
+bool Table<Schema>::remove(const string& key) {
+    unique_lock<shared_mutex> lock(tableMutex);
+    const int* pos = position(key);
+    if (!pos)
+        return false;
+    int removed = *pos;
+    Row old = Row::fromStored(readLine(removed));
+    if (!release({removed}))
+        return false;
+    erasePosition(key);
+    indexRow(old, false, make_index_sequence<SECONDARY_COUNT>());
+    return true;
+}
+
+template <typename Schema>
+size_t Table<Schema>::size() const {
+    shared_lock<shared_mutex> lock(tableMutex);
+    return primary.size();
+}
+
+template <typename Schema>
+const int* Table<Schema>::position(string_view key) const {
+    StringHandle handle = stringPool.find(key);
+    return handle == StringPool::NONE ? nullptr : primary.find(handle);
+}
+
+template <typename Schema>
+void Table<Schema>::setPosition(string_view key, int position) {
+    primary.set(stringPool.intern(key), position);
+}
+
+template <typename Schema>
+bool Table<Schema>::erasePosition(string_view key) {
+    StringHandle handle = stringPool.find(key);
+    return handle != StringPool::NONE && primary.erase(handle);
+}
+
+template <typename Schema>
+string Table<Schema>::tag(const string& name) const {
+    auto it = tags.find(name);
+    return it == tags.end() ? string() : it->second;
+}
+
+template <typename Schema>
+template <size_t... I>
+void Table<Schema>::indexRow(const Row& row, bool add, index_sequence<I...>) {
+    ((add ? std::get<I>(secondary).add(row) : std::get<I>(secondary).remove(row)), ...);
+}
+
+template <typename Schema>
+string Table<Schema>::readLine(int position) const {
+    ScopedTimer timer(OP_READ_RECORD);
+    ifstream file(DATA_FILE, ios::in | ios::binary);
+    file.seekg(position, ios::beg);
+    string line;
+    getline(file, line);
+    metrics.addBytesRead(OP_READ_RECORD, line.length() + 1);
+    return line;
+}
+
+template <typename Schema>
+vector<pair<int, string>> Table<Schema>::readLines(vector<int> positions) const {
+    ScopedTimer timer(OP_READ_RECORD);
+    sort(positions.begin(), positions.end());
+    vector<pair<int, string>> lines;
+    ifstream file(DATA_FILE, ios::in | ios::binary);
+    for (int position : positions) {
+        string line;
+        file.clear();
+        file.seekg(position, ios::beg);
+        getline(file, line);
+        metrics.addBytesRead(OP_READ_RECORD, line.length() + 1);
+        lines.push_back({position, move(line)});
+    }
+    return lines;
+}
+
+template <typename Schema>
+int Table<Schema>::write(const Row& row) {
+    string stored = row.stored();
+    int position = -1;
+    size_t slot = avail.size();
+    while (slot-- > 0) {
+        if (readLine(avail[slot]).length() >= stored.length()) {
+            position = avail[slot];
+            break;
+        }
+    }
+    { ofstream create(DATA_FILE, ios::out | ios::app | ios::binary); }
+    fstream file(DATA_FILE, ios::in | ios::out | ios::binary);
+    if (!file)
+        return -1;
+    if (position == -1) {
+        file.seekp(0, ios::end);
+        position = file.tellp();
+    } else {
+        avail.erase(avail.begin() + slot);
+    }
+    file.seekp(position, ios::beg);
+    file << stored << "\n";
+    metrics.addBytesWritten(OP_WRITE_RECORD, stored.length() + 1);
+    return position;
+}
+
+template <typename Schema>
+int Table<Schema>::rewrite(int position, const Row& row) {
+    string stored = row.stored();
+    if (deferSlotReuse || stored.length() != readLine(position).length()) {
+        int moved = write(row);
+        if (moved >= 0)
+            release({position});
+        return moved;
+    }
+    fstream file(DATA_FILE, ios::in | ios::out | ios::binary);
+    if (!file)
+        return -1;
+    file.seekp(position, ios::beg);
+    file << stored;
+    metrics.addBytesWritten(OP_WRITE_RECORD, stored.length());
+    return position;
+}
+
+template <typename Schema>
+bool Table<Schema>::release(vector<int> positions) {
+    if (!deferSlotReuse)
+        return tombstone(move(positions), avail);
+    freed.insert(freed.end(), positions.begin(), positions.end());
+    return true;
+}
+
+template <typename Schema>
+void Table<Schema>::reuseSlots(const vector<int>& positions) {
+    if (!tombstone(positions, avail))
+        cerr << "Error: Unable to open " << DATA_FILE << " to free " << positions.size() << " slots." << endl;
+}
+
+// Slots already tombstoned are skipped, so none is freed twice.
+template <typename Schema>
+bool Table<Schema>::tombstone(vector<int> positions, vector<int>& freedSlots) {
+    ScopedTimer timer(OP_MARK_DELETED);
+    if (positions.empty())
+        return true;
+    fstream file(DATA_FILE, ios::in | ios::out | ios::binary);
+    if (!file)
+        return false;
+    sort(positions.begin(), positions.end());
+    positions.erase(unique(positions.begin(), positions.end()), positions.end());
+    for (int position : positions) {
+        string line;
+        file.clear();
+        file.seekg(position, ios::beg);
+        getline(file, line);
+        metrics.addBytesRead(OP_MARK_DELETED, line.length() + 1);
+        if (line.empty() || line.back() == '*')
+            continue;
+        file.clear();
+        file.seekp(position + line.length() - 1, ios::beg);
+        file.put('*');
+        metrics.addBytesWritten(OP_MARK_DELETED, 1);
+        freedSlots.push_back(position);
+    }
+    return true;
+}
+
+// Read-only, block-compressed storage for cold appointments (appointments.blk).
+//
+// Layout: "HCB1" | blockCount | dictCount | doctor ID dictionary | block directory
+// (offset, length per block) | blocks. Each block holds up to RECORDS_PER_BLOCK
+// records sorted by date, an offset table for direct slot access, and per record a
+// flags byte, the dictionary index of the doctor ID, the date as a varint delta from
+// the block's first day and the appointment ID. Dates that do not round-trip through
+// parseDate are stored as raw text. A record is addressed by (block, slot), which the
+// primary index stores as a negative position.
+//
+// Deleting or updating a compressed appointment only repoints the primary index; the
+// old copy stays in its block until the next compression, so callers of readAll()
+// must check records against the index. The hot store is never rewritten in place:
+// each compression writes a new generation (appointments.N.blk) that
+// appointment.index names, so the saved index always matches the file it points into.
+// Snapshots keep the generation their refs belong to, and a generation's file is
+// deleted only once no snapshot holds it.
+class AppointmentBlockStore {
+public:
+    static const int RECORDS_PER_BLOCK = 256;
+    const string BLOCK_FILE;
+
+    explicit AppointmentBlockStore(const string& fileName = "appointments.blk") : BLOCK_FILE(fileName) {}
+
+    static bool isBlockRef(int position) { return position < 0; }
+    static int makeRef(int block, int slot) { return -(block * RECORDS_PER_BLOCK + slot) - 1; }
+
+    bool load();
+    string readRecord(int ref) const;
+    vector<pair<int, string>> readAll() const;
+    vector<int> rewrite(const vector<string>& records);
+    size_t blockCount() const { return directory.size(); }
+    // Records in the store, live or not; every block but the last is full.
+    size_t recordCount() const { return storedRecords; }
+
+private:
+    enum { RAW_DATE = 1, PAD_MONTH = 2, PAD_DAY = 4, HAS_TIME = 8 };
+    vector<string> dictionary;
+    vector<pair<uint32_t, uint32_t>> directory;
+    size_t storedRecords = 0;
+
+    static void putVarint(string& out, uint64_t value);
+    static uint64_t getVarint(const string& in, size_t& pos);
+    static void putU32(string& out, uint32_t value);
+    static uint32_t getU32(const string& in, size_t pos);
+    string decodeSlot(const string& data, int slot) const;
+    static string encodeBlock(const vector<string>& records, const map<string, uint32_t>& dictionaryIndex);
+};
+
+void AppointmentBlockStore::putVarint(string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+uint64_t AppointmentBlockStore::getVarint(const string& in, size_t& pos) {
+    uint64_t value = 0;
+    int shift = 0;
+    while (pos < in.size()) {
+        unsigned char byte = in[pos++];
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            break;
+        shift += 7;
+    }
+    return value;
+}
+
+void AppointmentBlockStore::putU32(string& out, uint32_t value) {
+    for (int i = 0; i < 4; i++)
+        out.push_back((char)((value >> (8 * i)) & 0xff));
+}
+
+uint32_t AppointmentBlockStore::getU32(const string& in, size_t pos) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++)
+        value |= (uint32_t)(unsigned char)in[pos + i] << (8 * i);
+    return value;
+}
+
+bool AppointmentBlockStore::load() {
+    dictionary.clear();
+    directory.clear();
+    storedRecords = 0;
+    ifstream file(BLOCK_FILE, ios::in | ios::binary);
+    if (!file)
+        return false;
+    string header(12, '\0');
+    if (!file.read(&header[0], 12) || header.compare(0, 4, "HCB1") != 0) {
+        cerr << "Error: " << BLOCK_FILE << " is not a block store." << endl;
+        return false;
+    }
+    uint32_t blocks = getU32(header, 4);
+    uint32_t dictCount = getU32(header, 8);
+    for (uint32_t i = 0; i < dictCount; i++) {
+        unsigned char len = (unsigned char)file.get();
+        string doctorID(len, '\0');
+        file.read(&doctorID[0], len);
+        dictionary.push_back(doctorID);
+    }
+    string dir(blocks * 8, '\0');
+    file.read(&dir[0], dir.size());
+    for (uint32_t i = 0; i < blocks; i++)
+        directory.push_back({getU32(dir, i * 8), getU32(dir, i * 8 + 4)});
+    metrics.addBytesRead(OP_LOAD_INDEXES, 12 + dir.size() + (uint64_t)file.tellg());
+    if (!file)
+        return false;
+    if (!directory.empty()) {
+        string lastCount(4, '\0');
+        file.seekg(directory.back().first, ios::beg);
+        file.read(&lastCount[0], 4);
+        storedRecords = (directory.size() - 1) * RECORDS_PER_BLOCK + getU32(lastCount, 0);
+    }
+    return (bool)file;
+}
+
+string AppointmentBlockStore::encodeBlock(const vector<string>& records, const map<string, uint32_t>& dictionaryIndex) {
+    vector<ParsedDate> dates(records.size());
+    vector<bool> parsed(records.size());
+    int baseDay = INT32_MAX;
+    for (size_t i = 0; i < records.size(); i++) {
+        string date = records[i].substr(records[i].find('|') + 1, records[i].rfind('|') - records[i].find('|') - 1);
+        parsed[i] = parseDate(date, dates[i]) && formatDate(dates[i]) == date;
+        if (parsed[i])
+            baseDay = min(baseDay, dates[i].days);
+    }
+    if (baseDay == INT32_MAX)
+        baseDay = 0;
+
+    string payload;
+    vector<uint32_t> offsets;
+    for (size_t i = 0; i < records.size(); i++) {
+        const string& record = records[i];
+        size_t d1 = record.find('|');
+        size_t d2 = record.rfind('|');
+        string id = record.substr(0, d1);
+        string date = record.substr(d1 + 1, d2 - d1 - 1);
+        string doctorID = record.substr(d2 + 1);
+        offsets.push_back(payload.size());
+        unsigned char flags = 0;
+        if (!parsed[i])
+            flags |= RAW_DATE;
+        else {
+            if (dates[i].padMonth) flags |= PAD_MONTH;
+            if (dates[i].padDay) flags |= PAD_DAY;
+            if (dates[i].minuteOfDay >= 0) flags |= HAS_TIME;
+        }
+        payload.push_back((char)flags);
+        putVarint(payload, dictionaryIndex.at(doctorID));
+        if (flags & RAW_DATE) {
+            putVarint(payload, date.size());
+            payload += date;
+        } else {
+            putVarint(payload, dates[i].days - baseDay);
+            if (flags & HAS_TIME)
+                putVarint(payload, dates[i].minuteOfDay);
+        }
+        putVarint(payload, id.size());
+        payload += id;
+    }
+    string block;
+    putU32(block, records.size());
+    putU32(block, (uint32_t)baseDay);
+    for (uint32_t offset : offsets)
+        putU32(block, offset);
+    return block + payload;
+}
+
+string AppointmentBlockStore::decodeSlot(const string& data, int slot) const {
+    uint32_t count = getU32(data, 0);
+    if ((uint32_t)slot >= count)
+        return "";
+    int baseDay = (int)getU32(data, 4);
+    size_t pos = 8 + count * 4 + getU32(data, 8 + slot * 4);
+
+    unsigned char flags = data[pos++];
+    string doctorID = dictionary[getVarint(data, pos)];
+    string date;
+    if (flags & RAW_DATE) {
+        size_t len = getVarint(data, pos);
+        date = data.substr(pos, len);
+        pos += len;
+    } else {
+        ParsedDate parsed;
+        parsed.days = baseDay + (int)getVarint(data, pos);
+        parsed.padMonth = flags & PAD_MONTH;
+        parsed.padDay = flags & PAD_DAY;
+        parsed.minuteOfDay = (flags & HAS_TIME) ? (int)getVarint(data, pos) : -1;
+        date = formatDate(parsed);
+    }
+    size_t idLen = getVarint(data, pos);
+    return data.substr(pos, idLen) + "|" + date + "|" + doctorID;
+}
+
+string AppointmentBlockStore::readRecord(int ref) const {
+    ScopedTimer timer(OP_READ_RECORD);
+    int index = -ref - 1;
+    int block = index / RECORDS_PER_BLOCK;
+    int slot = index % RECORDS_PER_BLOCK;
+    if (block >= (int)directory.size())
+        return "";
+    ifstream file(BLOCK_FILE, ios::in | ios::binary);
+    string data(directory[block].second, '\0');
+    file.seekg(directory[block].first, ios::beg);
+    if (!file.read(&data[0], data.size()))
+        return "";
+    metrics.addBytesRead(OP_READ_RECORD, data.size());
+    string record = decodeSlot(data, slot);
+    if (record.empty())
+        return "";
+    stringstream ss;
+    ss << setw(4) << setfill('0') << record.length() << record;
+    return ss.str();
+}
+
+// Decodes every record in the store in one sequential pass, paired with its reference.
+vector<pair<int, string>> AppointmentBlockStore::readAll() const {
+    vector<pair<int, string>> records;
+    ifstream file(BLOCK_FILE, ios::in | ios::binary);
+    for (size_t block = 0; block < directory.size() && file; block++) {
+        string data(directory[block].second, '\0');
+        file.seekg(directory[block].first, ios::beg);
+        if (!file.read(&data[0], data.size()))
+            break;
+        metrics.addBytesRead(OP_READ_RECORD, data.size());
+        uint32_t count = getU32(data, 0);
+        for (uint32_t slot = 0; slot < count; slot++)
+            records.push_back({makeRef(block, slot), decodeSlot(data, slot)});
+    }
+    return records;
+}
+
+// Replaces the store with the given "id|date|doctorID" records and returns the
+// reference of each record, in input order.
+vector<int> AppointmentBlockStore::rewrite(const vector<string>& records) {
+    vector<size_t> order(records.size());
+    vector<int> sortKeys(records.size());
+    map<string, uint32_t> dictionaryIndex;
+    vector<string> newDictionary;
+    for (size_t i = 0; i < records.size(); i++) {
+        order[i] = i;
+        size_t d1 = records[i].find('|');
+        size_t d2 = records[i].rfind('|');
+        ParsedDate date;
+        sortKeys[i] = parseDate(records[i].substr(d1 + 1, d2 - d1 - 1), date) ? date.days : INT32_MIN;
+        string doctorID = records[i].substr(d2 + 1);
+        if (dictionaryIndex.find(doctorID) == dictionaryIndex.end()) {
+            dictionaryIndex[doctorID] = newDictionary.size();
+            newDictionary.push_back(doctorID);
+        }
+    }
+    // Date order keeps the per-block deltas small.
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sortKeys[a] < sortKeys[b]; });
+
+    vector<int> refs(records.size());
+    vector<string> blocks;
+    for (size_t start = 0; start < order.size(); start += RECORDS_PER_BLOCK) {
+        vector<string> blockRecords;
+        for (size_t i = start; i < order.size() && i < start + RECORDS_PER_BLOCK; i++) {
+            refs[order[i]] = makeRef(blocks.size(), i - start);
+            blockRecords.push_back(records[order[i]]);
+        }
+        blocks.push_back(encodeBlock(blockRecords, dictionaryIndex));
+    }
+
+    string header = "HCB1";
+    putU32(header, blocks.size());
+    putU32(header, newDictionary.size());
+    for (const string& doctorID : newDictionary) {
+        header.push_back((char)doctorID.size());
+        header += doctorID;
+    }
+    uint32_t offset = header.size() + blocks.size() * 8;
+    vector<pair<uint32_t, uint32_t>> newDirectory;
+    for (const string& block : blocks) {
+        putU32(header, offset);
+        putU32(header, block.size());
+        newDirectory.push_back({offset, (uint32_t)block.size()});
+        offset += block.size();
+    }
+
+    string tempFile = BLOCK_FILE + ".tmp";
+    ofstream file(tempFile, ios::out | ios::trunc | ios::binary);
+    if (!file) {
+        cerr << "Error: Unable to open " << tempFile << " for writing." << endl;
+        return vector<int>();
+    }
+    file << header;
+    for (const string& block : blocks)
+        file << block;
+    file.close();
+    remove(BLOCK_FILE.c_str());
+    if (rename(tempFile.c_str(), BLOCK_FILE.c_str()) != 0) {
+        cerr << "Error: Unable to replace " << BLOCK_FILE << endl;
+        return vector<int>();
+    }
+    metrics.addBytesWritten(OP_SAVE_INDEXES, offset);
+    dictionary.swap(newDictionary);
+    directory.swap(newDirectory);
+    storedRecords = records.size();
+    return refs;
+}
+
+
+// Read-only archive tier for past appointments. Records live in their own block
+// store with a compact id -> (block, slot) index and a doctor -> appointment index,
+// both loaded only when a lookup first falls through to the archive. A Bloom filter
+// over the archived IDs is loaded at startup so that misses never load the index.
+class AppointmentArchive {
+public:
+    const string ARCHIVE_INDEX_FILE = "appointment_archive.index";
+    const string ARCHIVE_SECONDARY_INDEX_FILE = "appointment_archive_secondary.index";
+    const string ARCHIVE_BLOOM_FILE = "appointment_archive.bloom";
+    AppointmentBlockStore store{"appointments.archive"};
+    string cutoffDate;
+
+    void load();
+    bool mightContain(string_view appointmentID) const { return filter.mightContain(appointmentID); }
+    string find(string_view appointmentID);
+    vector<string> findByDoctor(string_view doctorID);
+    bool append(const vector<string>& records, const string& newCutoffDate);
+    size_t size();
+
+private:
+    BloomFilter filter;
+    once_flag indexLoaded;
+    vector<pair<StringHandle, int>> index;
+    map<StringHandle, vector<StringHandle>> byDoctor;
+
+    void ensureIndexLoaded();
+    void loadIndex();
+    void saveIndex();
+    void rebuildFilter();
+};
+
+// The index starts with "#cutoff|date" and "#count|n". The filter is the only gate in
+// front of the archive, so one that is missing or disagrees with the count is rebuilt
+// from the index; indexes written without a count are loaded to get it.
+void AppointmentArchive::load() {
+    store.load();
+    ifstream file(ARCHIVE_INDEX_FILE, ios::in);
+    string header;
+    if (file && getline(file, header) && header.rfind("#cutoff|", 0) == 0)
+        cutoffDate = header.substr(8);
+    bool hasCount = file && getline(file, header) && header.rfind("#count|", 0) == 0;
+    size_t archived = hasCount ? strtoull(header.c_str() + 7, nullptr, 10) : 0;
+    if (!filter.load(ARCHIVE_BLOOM_FILE) || filter.keyCount() != (hasCount ? archived : size()))
+        rebuildFilter();
+}
+
+void AppointmentArchive::rebuildFilter() {
+    ensureIndexLoaded();
+    filter.reset(index.size(), filter.falsePositiveRate);
+    for (const auto& entry : index)
+        filter.add(string(stringPool.str(entry.first)));
+    if (!index.empty())
+        filter.save(ARCHIVE_BLOOM_FILE);
+}
+
+void AppointmentArchive::ensureIndexLoaded() {
+    call_once(indexLoaded, [this] { loadIndex(); });
+}
+
+void AppointmentArchive::loadIndex() {
+    fstream indexFile(ARCHIVE_INDEX_FILE, ios::in);
+    if (indexFile.is_open()) {
+        string line;
+        while (getline(indexFile, line)) {
+            metrics.addBytesRead(OP_LOAD_INDEXES, line.length() + 1);
+            if (line.empty() || line[0] == '#')
+                continue;
+            stringstream ss(line);
+            string appointmentID;
+            int ref;
+            getline(ss, appointmentID, '|');
+            ss >> ref;
+            index.push_back({stringPool.intern(appointmentID), ref});
+        }
+        indexFile.close();
+    }
+    sort(index.begin(), index.end());
+    fstream secondaryFile(ARCHIVE_SECONDARY_INDEX_FILE, ios::in);
+    if (secondaryFile.is_open()) {
+        string line;
+        while (getline(secondaryFile, line)) {
+            metrics.addBytesRead(OP_LOAD_INDEXES, line.length() + 1);
+            stringstream ss(line);
+            string doctorID, appointmentID;
+            getline(ss, doctorID, '|');
+            vector<StringHandle>& appointments = byDoctor[stringPool.intern(doctorID)];
+            while (getline(ss, appointmentID, '|'))
+                appointments.push_back(stringPool.intern(appointmentID));
+        }
+        secondaryFile.close();
+    }
+}
+
+void AppointmentArchive::saveIndex() {
+    ofstream indexFile(ARCHIVE_INDEX_FILE, ios::out | ios::trunc);
+    if (!indexFile) {
+        cerr << "Error: Unable to open " << ARCHIVE_INDEX_FILE << " for writing." << endl;
+        return;
+    }
+    indexFile << "#cutoff|" << cutoffDate << "\n";
+    indexFile << "#count|" << index.size() << "\n";
+    for (const auto& entry : index)
+        indexFile << stringPool.str(entry.first) << "|" << entry.second << "\n";
+    metrics.addBytesWritten(OP_SAVE_INDEXES, (uint64_t)indexFile.tellp());
+    indexFile.close();
+
+    ofstream secondaryFile(ARCHIVE_SECONDARY_INDEX_FILE, ios::out | ios::trunc);
+    if (!secondaryFile) {
+        cerr << "Error: Unable to open " << ARCHIVE_SECONDARY_INDEX_FILE << " for writing." << endl;
+        return;
+    }
+    for (const auto& entry : byDoctor) {
+        secondaryFile << stringPool.str(entry.first);
+        for (StringHandle appointmentID : entry.second)
+            secondaryFile << "|" << stringPool.str(appointmentID);
+        secondaryFile << "\n";
+    }
+    metrics.addBytesWritten(OP_SAVE_INDEXES, (uint64_t)secondaryFile.tellp());
+    secondaryFile.close();
+    filter.save(ARCHIVE_BLOOM_FILE);
+}
+
+// Returns the archived record (with its length prefix), or "" when not archived.
+string AppointmentArchive::find(string_view appointmentID) {
+    if (!filter.mightContain(appointmentID))
+        return "";
+    ensureIndexLoaded();
+    int pos = binarySearch(index, stringPool.find(appointmentID));
+    return pos == -1 ? "" : store.readRecord(index[pos].second);
+}
+
+vector<string> AppointmentArchive::findByDoctor(string_view doctorID) {
+    if (store.blockCount() == 0)
+        return vector<string>();
+    ensureIndexLoaded();
+    vector<string> appointmentIDs;
+    auto it = byDoctor.find(stringPool.find(doctorID));
+    if (it != byDoctor.end()) {
+        for (StringHandle appointmentID : it->second)
+            appointmentIDs.emplace_back(stringPool.str(appointmentID));
+    }
+    return appointmentIDs;
+}
+
+size_t AppointmentArchive::size() {
+    ensureIndexLoaded();
+    return index.size();
+}
+
+// Adds "id|date|doctorID" records to the archive by rewriting the store once.
+bool AppointmentArchive::append(const vector<string>& records, const string& newCutoffDate) {
+    ensureIndexLoaded();
+    vector<string> all;
+    for (const auto& entry : store.readAll())
+        all.push_back(entry.second);
+    all.insert(all.end(), records.begin(), records.end());
+    vector<int> refs = store.rewrite(all);
+    if (refs.size() != all.size())
+        return false;
+
+    index.clear();
+    byDoctor.clear();
+    filter.reset(all.size(), filter.falsePositiveRate);
+    for (size_t i = 0; i < all.size(); i++) {
+        size_t d1 = all[i].find('|');
+        string appointmentID = all[i].substr(0, d1);
+        StringHandle handle = stringPool.intern(appointmentID);
+        index.push_back({handle, refs[i]});
+        byDoctor[stringPool.intern(string_view(all[i]).substr(all[i].rfind('|') + 1))].push_back(handle);
+        filter.add(appointmentID);
+    }
+    sort(index.begin(), index.end());
+    ParsedDate previous, next;
+    if (!parseDate(cutoffDate, previous) || (parseDate(newCutoffDate, next) && next.days > previous.days))
+        cutoffDate = newCutoffDate;
+    saveIndex();
+    return true;
+}
+
+
+// Booked 15-minute slots per doctor per day, kept as bitmaps so that "next free
+// slot" and "who is free at T" are answered with word-level scans. Two views are
+// maintained: one bitmap of slots per (doctor, day), and one bitmap of doctors per
+// (day, slot) indexed by a dense per-doctor number. Only appointments whose date
+// carries a time ("YYYY-MM-DD HH:MM") occupy a slot.
+class AvailabilityIndex {
+public:
+    static const int SLOT_MINUTES = 15;
+    static const int SLOTS_PER_DAY = 24 * 60 / SLOT_MINUTES;
+    static const int WORDS_PER_DAY = (SLOTS_PER_DAY + 63) / 64;
+    static const int FIRST_BOOKABLE_SLOT = 8 * 60 / SLOT_MINUTES;   // 08:00
+    static const int LAST_BOOKABLE_SLOT = 18 * 60 / SLOT_MINUTES;   // up to 18:00
+
+    void addDoctor(const string& doctorID);
+    void removeDoctor(const string& doctorID);
+    bool isBooked(const string& doctorID, int day, int slot) const;
+    void book(const string& doctorID, int day, int slot);
+    void release(const string& doctorID, int day, int slot);
+    bool nextFreeSlot(const string& doctorID, int day, int slot, int& freeDay, int& freeSlot, int horizonDays = 365) const;
+    vector<string> freeDoctors(int day, int slot) const;
+    void clear();
+
+private:
+    struct DaySlots {
+        uint64_t words[WORDS_PER_DAY] = {};
+    };
+    unordered_map<StringHandle, int> doctorNumbers;
+    vector<StringHandle> doctorIDs;
+    vector<uint64_t> activeDoctors;
+    unordered_map<uint64_t, DaySlots> bookedByDoctorDay;
+    unordered_map<int64_t, vector<uint64_t>> bookedBySlot;
+
+    int doctorNumber(const string& doctorID) const;
+    int assignNumber(const string& doctorID);
+    static uint64_t doctorDayKey(int doctorNo, int day) { return ((uint64_t)(uint32_t)doctorNo << 32) | (uint32_t)day; }
+    static int64_t slotKey(int day, int slot) { return (int64_t)day * SLOTS_PER_DAY + slot; }
+    static uint64_t bookableMask(int word);
+};
+
+uint64_t AvailabilityIndex::bookableMask(int word) {
+    uint64_t mask = 0;
+    for (int bit = 0; bit < 64; bit++) {
+        int slot = word * 64 + bit;
+        if (slot >= FIRST_BOOKABLE_SLOT && slot < LAST_BOOKABLE_SLOT)
+            mask |= 1ULL << bit;
+    }
+    return mask;
+}
+
+int AvailabilityIndex::doctorNumber(const string& doctorID) const {
+    auto it = doctorNumbers.find(stringPool.find(doctorID));
+    return it == doctorNumbers.end() ? -1 : it->second;
+}
+
+void AvailabilityIndex::clear() {
+    doctorNumbers.clear();
+    doctorIDs.clear();
+    activeDoctors.clear();
+    bookedByDoctorDay.clear();
+    bookedBySlot.clear();
+}
+
+// Numbers a doctor without making it active, so bookings of an unknown or deleted
+// doctor stay addressable but are never offered as free.
+int AvailabilityIndex::assignNumber(const string& doctorID) {
+    int number = doctorNumber(doctorID);
+    if (number == -1) {
+        number = doctorIDs.size();
+        StringHandle handle = stringPool.intern(doctorID);
+        doctorNumbers[handle] = number;
+        doctorIDs.push_back(handle);
+        if (activeDoctors.size() * 64 <= (size_t)number)
+            activeDoctors.push_back(0);
+    }
+    return number;
+}
+
+void AvailabilityIndex::addDoctor(const string& doctorID) {
+    int number = assignNumber(doctorID);
+    activeDoctors[number / 64] |= 1ULL << (number % 64);
+}
+
+// The doctor keeps its number so existing bookings stay addressable; it just stops
+// being offered as free.
+void AvailabilityIndex::removeDoctor(const string& doctorID) {
+    int number = doctorNumber(doctorID);
+    if (number != -1)
+        activeDoctors[number / 64] &= ~(1ULL << (number % 64));
+}
+
+bool AvailabilityIndex::isBooked(const string& doctorID, int day, int slot) const {
+    int number = doctorNumber(doctorID);
+    if (number == -1)
+        return false;
+    auto it = bookedByDoctorDay.find(doctorDayKey(number, day));
+    return it != bookedByDoctorDay.end() && (it->second.words[slot / 64] & (1ULL << (slot % 64)));
+}
+
+void AvailabilityIndex::book(const string& doctorID, int day, int slot) {
+    int number = assignNumber(doctorID);
+    bookedByDoctorDay[doctorDayKey(number, day)].words[slot / 64] |= 1ULL << (slot % 64);
+    vector<uint64_t>& doctors = bookedBySlot[slotKey(day, slot)];
+    if (doctors.size() <= (size_t)number / 64)
+        doctors.resize(number / 64 + 1, 0);
+    doctors[number / 64] |= 1ULL << (number % 64);
+}
+
+void AvailabilityIndex::release(const string& doctorID, int day, int slot) {
+    int number = doctorNumber(doctorID);
+    if (number == -1)
+        return;
+    auto dayIt = bookedByDoctorDay.find(doctorDayKey(number, day));
+    if (dayIt != bookedByDoctorDay.end()) {
+        dayIt->second.words[slot / 64] &= ~(1ULL << (slot % 64));
+        bool empty = true;
+        for (uint64_t word : dayIt->second.words)
+            empty = empty && word == 0;
+        if (empty)
+            bookedByDoctorDay.erase(dayIt);
+    }
+    auto slotIt = bookedBySlot.find(slotKey(day, slot));
+    if (slotIt != bookedBySlot.end() && slotIt->second.size() > (size_t)number / 64) {
+        slotIt->second[number / 64] &= ~(1ULL << (number % 64));
+        if (all_of(slotIt->second.begin(), slotIt->second.end(), [](uint64_t word) { return word == 0; }))
+            bookedBySlot.erase(slotIt);
+    }
+}
+
+// First bookable slot at or after (day, slot) within the horizon.
+bool AvailabilityIndex::nextFreeSlot(const string& doctorID, int day, int slot, int& freeDay, int& freeSlot, int horizonDays) const {
+    int number = doctorNumber(doctorID);
+    for (int d = day; d < day + horizonDays; d++) {
+        const uint64_t* booked = nullptr;
+        if (number != -1) {
+            auto it = bookedByDoctorDay.find(doctorDayKey(number, d));
+            if (it != bookedByDoctorDay.end())
+                booked = it->second.words;
+        }
+        int start = d == day ? slot : 0;
+        for (int w = start / 64; w < WORDS_PER_DAY; w++) {
+            uint64_t free = bookableMask(w) & ~(booked ? booked[w] : 0);
+            if (w == start / 64)
+                free &= ~0ULL << (start % 64);
+            if (free) {
+                freeDay = d;
+                freeSlot = w * 64 + __builtin_ctzll(free);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+vector<string> AvailabilityIndex::freeDoctors(int day, int slot) const {
+    vector<string> result;
+    auto it = bookedBySlot.find(slotKey(day, slot));
+    for (size_t w = 0; w < activeDoctors.size(); w++) {
+        uint64_t booked = (it != bookedBySlot.end() && w < it->second.size()) ? it->second[w] : 0;
+        uint64_t free = activeDoctors[w] & ~booked;
+        while (free) {
+            result.emplace_back(stringPool.str(doctorIDs[w * 64 + __builtin_ctzll(free)]));
+            free &= free - 1;
+        }
+    }
+    return result;
+}
+
+// Materialized appointment counts per (doctor, day), per day and per (doctor, month),
+// adjusted by every add, update and delete so load questions never touch the
+// appointment records. Archived appointments still count: archiving only moves them.
+// Dates that cannot be parsed are counted under UNKNOWN_DAY.
+class AppointmentCounters {
+public:
+    static const int UNKNOWN_DAY = INT_MIN;
+    const string COUNTS_FILE = "appointment_counts.index";
+
+    void adjust(const string& doctorID, const string& date, int delta);
+    int countForDoctor(string_view doctorID, int fromDay, int toDay) const;
+    int countForDoctor(string_view doctorID) const;
+    map<string, int> countByDoctor(int fromDay, int toDay) const;
+    vector<pair<int, int>> busiestDays(int fromDay, int toDay, size_t limit) const;
+    vector<pair<string, int>> overCapacity(int day, int capacity) const;
+    map<int, int> monthlyCounts(const string& doctorID) const;
+    bool load();
+    void save() const;
+    void clear();
+
+private:
+    unordered_map<StringHandle, unordered_map<int, int>> byDoctorDay;
+    unordered_map<StringHandle, int> byDoctor;
+    unordered_map<int, int> byDay;
+    unordered_map<StringHandle, unordered_map<int, int>> byDoctorMonth;
+
+    static int monthKey(int day);
+    void adjustDay(const string& doctorID, int day, int delta);
+    int countInRange(StringHandle doctor, int fromDay, int toDay) const;
+};
+
+int AppointmentCounters::monthKey(int day) {
+    if (day == UNKNOWN_DAY)
+        return 0;
+    int y, m, d;
+    civilFromDays(day, y, m, d);
+    return y * 100 + m;
+}
+
+void AppointmentCounters::adjustDay(const string& doctorID, int day, int delta) {
+    auto bump = [delta](auto& counts, const auto& key) {
+        auto it = counts.emplace(key, 0).first;
+        it->second += delta;
+        if (it->second <= 0)
+            counts.erase(it);
+    };
+    StringHandle doctor = stringPool.intern(doctorID);
+    auto& days = byDoctorDay[doctor];
+    bump(days, day);
+    if (days.empty())
+        byDoctorDay.erase(doctor);
+    bump(byDoctor, doctor);
+    bump(byDay, day);
+    auto& months = byDoctorMonth[doctor];
+    bump(months, monthKey(day));
+    if (months.empty())
+        byDoctorMonth.erase(doctor);
+}
+
+void AppointmentCounters::adjust(const string& doctorID, const string& date, int delta) {
+    ParsedDate parsed;
+    adjustDay(doctorID, parseDate(date, parsed) ? parsed.days : UNKNOWN_DAY, delta);
+}
+
+int AppointmentCounters::countForDoctor(string_view doctorID) const {
+    auto it = byDoctor.find(stringPool.find(doctorID));
+    return it == byDoctor.end() ? 0 : it->second;
+}
+
+int AppointmentCounters::countForDoctor(string_view doctorID, int fromDay, int toDay) const {
+    return countInRange(stringPool.find(doctorID), fromDay, toDay);
+}
+
+// Probes each day of short ranges and scans the doctor's days for long ones.
+int AppointmentCounters::countInRange(StringHandle doctor, int fromDay, int toDay) const {
+    auto it = byDoctorDay.find(doctor);
+    if (it == byDoctorDay.end() || toDay < fromDay)
+        return 0;
+    int total = 0;
+    if ((size_t)(toDay - fromDay + 1) <= it->second.size()) {
+        for (int day = fromDay; day <= toDay; day++) {
+            auto dayIt = it->second.find(day);
+            if (dayIt != it->second.end())
+                total += dayIt->second;
+        }
+    } else {
+        for (const auto& entry : it->second) {
+            if (entry.first >= fromDay && entry.first <= toDay)
+                total += entry.second;
+        }
+    }
+    return total;
+}
+
+map<string, int> AppointmentCounters::countByDoctor(int fromDay, int toDay) const {
+    map<string, int> counts;
+    for (const auto& entry : byDoctorDay) {
+        int total = countInRange(entry.first, fromDay, toDay);
+        if (total > 0)
+            counts[string(stringPool.str(entry.first))] = total;
+    }
+    return counts;
+}
+
+vector<pair<int, int>> AppointmentCounters::busiestDays(int fromDay, int toDay, size_t limit) const {
+    vector<pair<int, int>> days;
+    for (const auto& entry : byDay) {
+        if (entry.first != UNKNOWN_DAY && entry.first >= fromDay && entry.first <= toDay)
+            days.push_back(entry);
+    }
+    sort(days.begin(), days.end(), [](const pair<int, int>& a, const pair<int, int>& b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+    if (days.size() > limit)
+        days.resize(limit);
+    return days;
+}
+
+vector<pair<string, int>> AppointmentCounters::overCapacity(int day, int capacity) const {
+    vector<pair<string, int>> doctors;
+    for (const auto& entry : byDoctorDay) {
+        auto dayIt = entry.second.find(day);
+        if (dayIt != entry.second.end() && dayIt->second > capacity)
+            doctors.emplace_back(stringPool.str(entry.first), dayIt->second);
+    }
+    sort(doctors.begin(), doctors.end());
+    return doctors;
+}
+
+map<int, int> AppointmentCounters::monthlyCounts(const string& doctorID) const {
+    auto it = byDoctorMonth.find(stringPool.find(doctorID));
+    return it == byDoctorMonth.end() ? map<int, int>() : map<int, int>(it->second.begin(), it->second.end());
+}
+
+void AppointmentCounters::clear() {
+    byDoctorDay.clear();
+    byDoctor.clear();
+    byDay.clear();
+    byDoctorMonth.clear();
+}
+
+// Returns false when the file is missing or inconsistent, so the caller rebuilds.
+bool AppointmentCounters::load() {
+    clear();
+    ifstream file(COUNTS_FILE, ios::in);
+    if (!file)
+        return false;
+    // A truncated or hand-edited line fails the load instead of throwing.
+    auto parseInt = [](const string& text, int& value) {
+        char* end;
+        errno = 0;
+        long parsed = strtol(text.c_str(), &end, 10);
+        if (text.empty() || *end != '\0' || errno == ERANGE || parsed < INT_MIN || parsed > INT_MAX)
+            return false;
+        value = (int)parsed;
+        return true;
+    };
+    string line;
+    long long expectedTotal = -1, total = 0;
+    while (getline(file, line)) {
+        metrics.addBytesRead(OP_LOAD_INDEXES, line.length() + 1);
+        if (line.rfind("#total|", 0) == 0) {
+            expectedTotal = atoll(line.c_str() + 7);
+            continue;
+        }
+        stringstream ss(line);
+        string doctorID, day, count;
+        getline(ss, doctorID, '|');
+        getline(ss, day, '|');
+        getline(ss, count, '|');
+        int dayNumber = UNKNOWN_DAY, countValue;
+        if ((day != "?" && !parseInt(day, dayNumber)) || !parseInt(count, countValue))
+            return false;
+        adjustDay(doctorID, dayNumber, countValue);
+        total += countValue;
+    }
+    return expectedTotal == total;
+}
+
+void AppointmentCounters::save() const {
+    ofstream file(COUNTS_FILE, ios::out | ios::trunc);
+    if (!file) {
+        cerr << "Error: Unable to open " << COUNTS_FILE << " for writing." << endl;
+        return;
+    }
+    long long total = 0;
+    for (const auto& entry : byDoctor)
+        total += entry.second;
+    file << "#total|" << total << "\n";
+    for (const auto& doctor : byDoctorDay) {
+        for (const auto& day : doctor.second) {
+            file << stringPool.str(doctor.first) << "|";
+            if (day.first == UNKNOWN_DAY)
+                file << "?";
+            else
+                file << day.first;
+            file << "|" << day.second << "\n";
+        }
+    }
+    metrics.addBytesWritten(OP_SAVE_INDEXES, (uint64_t)file.tellp());
+    file.close();
+}
+
+string readWholeFile(const string& fileName, MetricOp op) {
+    ifstream file(fileName, ios::in | ios::binary);
+    string text;
+    if (file) {
+        file.seekg(0, ios::end);
+        text.resize((size_t)file.tellg());
+        file.seekg(0, ios::beg);
+        file.read(&text[0], text.size());
+    }
+    metrics.addBytesRead(op, text.size());
+    return text;
+}
+
+// Returns the first occurrence of c in [begin, end), or end. Compares 16 bytes at a
+// time where SSE2 is available.
+const char* findByte(const char* begin, const char* end, char c) {
+#if defined(__SSE2__)
+    const __m128i needle = _mm_set1_epi8(c);
+    while (end - begin >= 16) {
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)begin), needle));
+        if (mask)
+            return begin + __builtin_ctz(mask);
+        begin += 16;
+    }
+#endif
+    const void* found = memchr(begin, c, end - begin);
+    return found ? (const char*)found : end;
+}
+
+// Equality or substring test on one '|'-separated field of a record (0 is the ID).
+struct ScanPredicate {
+    int field;
+    bool contains;
+    string_view value;  // owned by the caller
+
+    bool matches(string_view record) const {
+        const char* begin = record.data();
+        const char* end = begin + record.size();
+        for (int i = 0; i < field && begin != end; i++)
+            begin = min(findByte(begin, end, '|') + 1, end);
+        string_view text(begin, findByte(begin, end, '|') - begin);
+        return contains ? text.find(value) != string_view::npos : text == value;
+    }
+};
+
+// Scans the image of a data file on all cores and returns the live records matching
+// the predicate, without their length prefix and in file order. Each core takes a
+// chunk starting at a line boundary. Tombstoned lines are skipped, as are lines whose
+// length prefix disagrees with their length, which are tails left by reused slots.
+vector<string_view> scanRecords(string_view text, const ScanPredicate& predicate) {
+    const size_t MIN_CHUNK = 1 << 20;
+    size_t threadCount = max(1u, thread::hardware_concurrency());
+    threadCount = max<size_t>(1, min(threadCount, text.size() / MIN_CHUNK));
+    vector<size_t> bounds = {0};
+    for (size_t t = 1; t < threadCount; t++) {
+        const char* start = text.data() + max(text.size() * t / threadCount, bounds.back() + 1) - 1;
+        bounds.push_back(min<size_t>(findByte(start, text.data() + text.size(), '\n') - text.data() + 1, text.size()));
+    }
+    bounds.push_back(text.size());
+
+    vector<vector<string_view>> chunks(threadCount);
+    vector<thread> workers;
+    for (size_t t = 0; t < threadCount; t++) {
+        workers.emplace_back([&, t]() {
+            const char* line = text.data() + bounds[t];
+            const char* chunkEnd = text.data() + bounds[t + 1];
+            while (line < chunkEnd) {
+                const char* lineEnd = findByte(line, chunkEnd, '\n');
+                string_view record(line, lineEnd - line);
+                line = lineEnd + 1;
+                if (!record.empty() && record.back() == '\r')
+                    record.remove_suffix(1);
+                if (record.size() <= 4 || record.back() == '*')
+                    continue;
+                size_t length = 0;
+                bool numeric = true;
+                for (int i = 0; i < 4; i++) {
+                    numeric = numeric && isdigit((unsigned char)record[i]);
+                    length = length * 10 + (record[i] - '0');
+                }
+                record.remove_prefix(4);
+                if (numeric && length == record.size() && predicate.matches(record))
+                    chunks[t].push_back(record);
+            }
+        });
+    }
+    for (thread& worker : workers)
+        worker.join();
+    vector<string_view> matches;
+    for (const auto& chunk : chunks)
+        matches.insert(matches.end(), chunk.begin(), chunk.end());
+    return matches;
+}
+
+// Streams a data file in SCAN_CHUNK_BYTES pieces, each cut at a line boundary and
+// scanned on all cores, so memory stays bounded however large the file is. Only lines
+// starting at one of the sorted live positions count: the others are dead records,
+// reused slots or records appended after the positions were taken. Matching records
+// go to match() in file order.
+const size_t SCAN_CHUNK_BYTES = 16 << 20;
+
+void scanLiveRecords(const string& fileName, const vector<int>& live, const ScanPredicate& predicate, MetricOp op,
+                     const function<void(string_view)>& match) {
+    ifstream file(fileName, ios::in | ios::binary);
+    string buffer;
+    size_t base = 0;  // file offset of buffer[0]
+    while (file) {
+        size_t kept = buffer.size();
+        buffer.resize(kept + SCAN_CHUNK_BYTES);
+        file.read(&buffer[kept], SCAN_CHUNK_BYTES);
+        buffer.resize(kept + file.gcount());
+        metrics.addBytesRead(op, file.gcount());
+        size_t end = buffer.size();
+        if (file) {
+            size_t lastLine = buffer.rfind('\n');
+            if (lastLine == string::npos)
+                continue;
+            end = lastLine + 1;
+        }
+        string_view text(buffer.data(), end);
+        for (string_view record : scanRecords(text, predicate)) {
+            if (binary_search(live.begin(), live.end(), (int)(base + (record.data() - 4 - text.data()))))
+                match(record);
+        }
+        buffer.erase(0, end);
+        base += end;
+    }
+}
+
+// Splits [0, count) into one contiguous chunk per hardware thread and runs parse(i, row)
+// on each index; rows for which parse returns true are kept, in index order.
+template <typename Row, typename Parse>
+vector<Row> parallelScan(size_t count, Parse parse) {
+    size_t threadCount = max(1u, thread::hardware_concurrency());
+    threadCount = min(threadCount, max<size_t>(1, count / 1024));
+    vector<vector<Row>> chunks(threadCount);
+    vector<thread> workers;
+    for (size_t t = 0; t < threadCount; t++) {
+        workers.emplace_back([&, t]() {
+            size_t begin = count * t / threadCount, end = count * (t + 1) / threadCount;
+            Row row;
+            for (size_t i = begin; i < end; i++) {
+                if (parse(i, row))
+                    chunks[t].push_back(row);
+            }
+        });
+    }
+    for (thread& worker : workers)
+        worker.join();
+    vector<Row> rows;
+    for (auto& chunk : chunks)
+        rows.insert(rows.end(), chunk.begin(), chunk.end());
+    return rows;
+}
+
+// Column-oriented copy of the live doctors and appointments for analytics tools.
+// All integers are little-endian. The file holds:
+//   "HCC1", u32 row group size
+//   doctor ID dictionary: u32 count, u32 offsets[count + 1], ID bytes
+//   doctors: u32 rows, u32 groups, per group (u32 first row, u32 rows, u32 min/max
+//     doctor code), then the columns id (u32 code), name and address (offsets + bytes)
+//   appointments: u32 rows, u32 groups, per group (u32 first row, u32 rows, i32 min/max
+//     day, u32 min/max doctor code), then the columns id (offsets + bytes), day (i32 days
+//     since 1970-01-01, INT32_MIN if unparseable), minute (i16 minute of day, -1 if none),
+//     doctor (u32 code) and tier (u8: 0 text file, 1 compressed, 2 archived)
+// Doctors are sorted by ID and appointments by date so row group ranges can be used
+// for pruning.
+// Rows reference text owned by the caller, which must outlive write().
+class ColumnarSnapshot {
+public:
+    static const uint32_t ROW_GROUP_SIZE = 4096;
+    enum { TIER_TEXT = 0, TIER_COMPRESSED = 1, TIER_ARCHIVED = 2 };
+
+    struct DoctorRow {
+        string_view id, name, address;
+    };
+    struct AppointmentRow {
+        string_view id, doctorID;
+        int32_t day;
+        int16_t minute;
+        uint8_t tier;
+    };
+
+    vector<DoctorRow> doctors;
+    vector<AppointmentRow> appointments;
+
+    uint64_t write(const string& fileName);
+
+private:
+    vector<string_view> dictionary;
+
+    template <typename T>
+    static void put(string& out, T value);
+    static void putStrings(string& out, const vector<string_view>& values);
+    uint32_t code(string_view doctorID) const;
+};
+
+template <typename T>
+void ColumnarSnapshot::put(string& out, T value) {
+    for (size_t i = 0; i < sizeof(T); i++)
+        out.push_back((char)(((uint64_t)value >> (8 * i)) & 0xff));
+}
+
+void ColumnarSnapshot::putStrings(string& out, const vector<string_view>& values) {
+    uint32_t offset = 0;
+    put<uint32_t>(out, 0);
+    for (string_view value : values) {
+        offset += value.size();
+        put<uint32_t>(out, offset);
+    }
+    for (string_view value : values)
+        out.append(value.data(), value.size());
+}
+
+uint32_t ColumnarSnapshot::code(string_view doctorID) const {
+    return lower_bound(dictionary.begin(), dictionary.end(), doctorID) - dictionary.begin();
+}
+
+// Returns the number of bytes written, or 0 on failure.
+uint64_t ColumnarSnapshot::write(const string& fileName) {
+    sort(doctors.begin(), doctors.end(), [](const DoctorRow& a, const DoctorRow& b) { return a.id < b.id; });
+    sort(appointments.begin(), appointments.end(), [](const AppointmentRow& a, const AppointmentRow& b) {
+        if (a.day != b.day)
+            return a.day < b.day;
+        return a.minute != b.minute ? a.minute < b.minute : a.id < b.id;
+    });
+    dictionary.clear();
+    for (const DoctorRow& row : doctors)
+        dictionary.push_back(row.id);
+    for (const AppointmentRow& row : appointments)
+        dictionary.push_back(row.doctorID);
+    sort(dictionary.begin(), dictionary.end());
+    dictionary.erase(unique(dictionary.begin(), dictionary.end()), dictionary.end());
+
+    string out = "HCC1";
+    put<uint32_t>(out, ROW_GROUP_SIZE);
+    put<uint32_t>(out, dictionary.size());
+    putStrings(out, dictionary);
+
+    vector<uint32_t> doctorCodes;
+    vector<string_view> names, addresses;
+    for (const DoctorRow& row : doctors) {
+        doctorCodes.push_back(code(row.id));
+        names.push_back(row.name);
+        addresses.push_back(row.address);
+    }
+    uint32_t groups = (doctors.size() + ROW_GROUP_SIZE - 1) / ROW_GROUP_SIZE;
+    put<uint32_t>(out, doctors.size());
+    put<uint32_t>(out, groups);
+    for (uint32_t g = 0; g < groups; g++) {
+        size_t first = (size_t)g * ROW_GROUP_SIZE, last = min(first + ROW_GROUP_SIZE, doctors.size());
+        auto range = minmax_element(doctorCodes.begin() + first, doctorCodes.begin() + last);
+        put<uint32_t>(out, first);
+        put<uint32_t>(out, last - first);
+        put<uint32_t>(out, *range.first);
+        put<uint32_t>(out, *range.second);
+    }
+    for (uint32_t value : doctorCodes)
+        put<uint32_t>(out, value);
+    putStrings(out, names);
+    putStrings(out, addresses);
+
+    vector<string_view> ids;
+    vector<uint32_t> appointmentCodes;
+    for (const AppointmentRow& row : appointments) {
+        ids.push_back(row.id);
+        appointmentCodes.push_back(code(row.doctorID));
+    }
+    groups = (appointments.size() + ROW_GROUP_SIZE - 1) / ROW_GROUP_SIZE;
+    put<uint32_t>(out, appointments.size());
+    put<uint32_t>(out, groups);
+    for (uint32_t g = 0; g < groups; g++) {
+        size_t first = (size_t)g * ROW_GROUP_SIZE, last = min(first + ROW_GROUP_SIZE, appointments.size());
+        auto range = minmax_element(appointmentCodes.begin() + first, appointmentCodes.begin() + last);
+        put<uint32_t>(out, first);
+        put<uint32_t>(out, last - first);
+        put<int32_t>(out, appointments[first].day);
+        put<int32_t>(out, appointments[last - 1].day);
+        put<uint32_t>(out, *range.first);
+        put<uint32_t>(out, *range.second);
+    }
+    putStrings(out, ids);
+    for (const AppointmentRow& row : appointments)
+        put<int32_t>(out, row.day);
+    for (const AppointmentRow& row : appointments)
+        put<int16_t>(out, row.minute);
+    for (uint32_t value : appointmentCodes)
+        put<uint32_t>(out, value);
+    for (const AppointmentRow& row : appointments)
+        put<uint8_t>(out, row.tier);
+
+    string tempFile = fileName + ".tmp";
+    ofstream file(tempFile, ios::out | ios::trunc | ios::binary);
+    if (!file) {
+        cerr << "Error: Unable to open " << tempFile << " for writing." << endl;
+        return 0;
+    }
+    file << out;
+    file.close();
+    remove(fileName.c_str());
+    if (rename(tempFile.c_str(), fileName.c_str()) != 0) {
+        cerr << "Error: Unable to replace " << fileName << endl;
+        return 0;
+    }
+    metrics.addBytesWritten(OP_EXPORT_SNAPSHOT, out.size());
+    return out.size();
+}
+
+// Ordered, append-only log of the mutations applied to the data files. Each line is
+// seq|operation|argument|... and is written once the change has been made, so another
+// instance that replays the lines in order through the same operations reaches the
+// same data files and indexes.
+class ChangeLog {
+public:
+    const string LOG_FILE = "changes.log";
+
+    void load();
+    uint64_t lastSequence() const { return sequence; }
+    void append(uint64_t seq, const vector<string>& entry);
+    static bool parse(const string& line, uint64_t& seq, vector<string>& entry);
+
+private:
+    uint64_t sequence = 0;
+};
+
+void ChangeLog::load() {
+    sequence = 0;
+    ifstream file(LOG_FILE, ios::in);
+    string line;
+    while (getline(file, line)) {
+        uint64_t seq;
+        vector<string> entry;
+        if (parse(line, seq, entry))
+            sequence = max(sequence, seq);
+    }
+}
+
+void ChangeLog::append(uint64_t seq, const vector<string>& entry) {
+    ofstream file(LOG_FILE, ios::out | ios::app);
+    if (!file) {
+        cerr << "Error: Unable to open " << LOG_FILE << " for writing." << endl;
+        return;
+    }
+    string line = to_string(seq);
+    for (const string& field : entry)
+        line += "|" + field;
+    file << line << "\n";
+    file.flush();
+    metrics.addBytesWritten(OP_SAVE_INDEXES, line.length() + 1);
+    sequence = seq;
+}
+
+// Empty fields are kept, so "3|update_doctor|7||new address" has an empty name.
+bool ChangeLog::parse(const string& line, uint64_t& seq, vector<string>& entry) {
+    entry.clear();
+    size_t start = 0;
+    while (true) {
+        size_t end = line.find('|', start);
+        entry.push_back(line.substr(start, end == string::npos ? string::npos : end - start));
+        if (end == string::npos)
+            break;
+        start = end + 1;
+    }
+    if (entry.size() < 2 || entry[0].empty() || entry[0].find_first_not_of("0123456789") != string::npos)
+        return false;
+    seq = stoull(entry[0]);
+    entry.erase(entry.begin());
+    return true;
+}
+
+// Optional record of the operations a session runs, one JSON object per line:
+// {"op":"add_doctor","args":["7","Jane Doe","12 Main St"]}. Writes use the change log
+// names; reads and queries are traced too, so --replay can run the same workload
+// against a fresh data directory.
+class TraceRecorder {
+public:
+    bool open(const string& fileName);
+    bool isOpen() const { return file.is_open(); }
+    void record(const char* operation, initializer_list<string_view> args);
+    static bool parse(const string& line, vector<string>& entry);
+
+private:
+    ofstream file;
+    mutex fileMutex;
+
+    static void appendString(string& line, string_view value);
+    static bool parseString(const string& line, size_t& i, string& value);
+};
+
+TraceRecorder workloadTrace;
+
+bool TraceRecorder::open(const string& fileName) {
+    file.open(fileName, ios::out | ios::app);
+    if (!file) {
+        cerr << "Error: Unable to open " << fileName << " for writing." << endl;
+        return false;
+    }
+    return true;
+}
+
+void TraceRecorder::record(const char* operation, initializer_list<string_view> args) {
+    string line = "{\"op\":";
+    appendString(line, operation);
+    line += ",\"args\":[";
+    for (auto it = args.begin(); it != args.end(); ++it) {
+        if (it != args.begin())
+            line += ',';
+        appendString(line, *it);
+    }
+    line += "]}\n";
+    lock_guard<mutex> lock(fileMutex);
+    file << line;
+    file.flush();
+}
+
+void TraceRecorder::appendString(string& line, string_view value) {
+    line += '"';
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            line += '\\';
+            line += c;
+        } else if ((unsigned char)c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+            line += escaped;
+        } else {
+            line += c;
+        }
+    }
+    line += '"';
+}
+
+// Reads a JSON string starting at line[i], which must be the opening quote. Escapes
+// beyond what appendString writes are accepted for hand-edited traces; \u escapes
+// are limited to single-byte characters.
+bool TraceRecorder::parseString(const string& line, size_t& i, string& value) {
+    if (i >= line.size() || line[i] != '"')
+        return false;
+    value.clear();
+    for (i++; i < line.size(); i++) {
+        char c = line[i];
+        if (c == '"') {
+            i++;
+            return true;
+        }
+        if (c != '\\') {
+            value += c;
+            continue;
+        }
+        if (++i >= line.size())
+            return false;
+        switch (line[i]) {
+            case 'n': value += '\n'; break;
+            case 't': value += '\t'; break;
+            case 'r': value += '\r'; break;
+            case 'b': value += '\b'; break;
+            case 'f': value += '\f'; break;
+            case 'u': {
+                if (i + 4 >= line.size())
+                    return false;
+                unsigned code = (unsigned)strtoul(line.substr(i + 1, 4).c_str(), nullptr, 16);
+                if (code > 0xFF)
+                    return false;
+                value += (char)code;
+                i += 4;
+                break;
+            }
+            default: value += line[i]; break;
+        }
+    }
+    return false;
+}
+
+// entry[0] is the operation and the rest its arguments, as applyChange expects.
+bool TraceRecorder::parse(const string& line, vector<string>& entry) {
+    entry.assign(1, string());
+    size_t i = 0;
+    auto skipSpace = [&]() { while (i < line.size() && isspace((unsigned char)line[i])) i++; };
+    auto expect = [&](char c) { skipSpace(); if (i < line.size() && line[i] == c) { i++; return true; } return false; };
+    if (!expect('{'))
+        return false;
+    bool hasOperation = false;
+    do {
+        string key;
+        skipSpace();
+        if (!parseString(line, i, key) || !expect(':'))
+            return false;
+        skipSpace();
+        if (key == "op") {
+            if (!parseString(line, i, entry[0]))
+                return false;
+            hasOperation = true;
+        } else if (key == "args") {
+            if (!expect('['))
+                return false;
+            if (!expect(']')) {
+                do {
+                    string value;
+                    skipSpace();
+                    if (!parseString(line, i, value))
+                        return false;
+                    entry.push_back(value);
+                } while (expect(','));
+                if (!expect(']'))
+                    return false;
+            }
+        } else {
+            return false;
+        }
+    } while (expect(','));
+    return expect('}') && hasOperation && !entry[0].empty();
+}
+
+// Traces the operation it is constructed for, unless another traced operation is
+// already running on this thread: a query traces once, not once per lookup it makes.
+// A null operation records nothing and only hides what runs inside it.
+class TraceScope {
+public:
+    TraceScope(const char* operation, initializer_list<string_view> args) {
+        if (depth++ == 0 && operation && workloadTrace.isOpen())
+            workloadTrace.record(operation, args);
+    }
+    ~TraceScope() { depth--; }
+
+private:
+    static thread_local int depth;
+};
+
+thread_local int TraceScope::depth = 0;
+
+// Immutable version of the in-memory indexes. Writers build a new one after each
+// change and publish it with an atomic pointer swap; readers grab the current one
+// without locking and keep it alive for as long as they use it. Parts that did not
+// change are shared with the previous version, and a changed index is a ChunkedMap
+// copy that shares every chunk the change did not touch. Keys are StringPool
+// handles, like in the live indexes.
+struct IndexSnapshot {
+    uint64_t version = 0;
+    shared_ptr<const PrimaryIndex> doctorPrimary;
+    shared_ptr<const PrimaryIndex> appointmentPrimary;
+    shared_ptr<const Postings> doctorsByName;
+    shared_ptr<const Postings> appointmentsByDoctor;
+    shared_ptr<const BloomFilter> doctorFilter;
+    shared_ptr<const BloomFilter> appointmentFilter;
+    shared_ptr<const BloomFilter> doctorNameFilter;
+    shared_ptr<const BloomFilter> appointmentDoctorFilter;
+    shared_ptr<const AppointmentBlockStore> appointmentBlocks;
+};
+
+enum SnapshotPart {
+    SNAPSHOT_DOCTORS = 1,
+    SNAPSHOT_APPOINTMENTS = 2,
+    SNAPSHOT_ALL = SNAPSHOT_DOCTORS | SNAPSHOT_APPOINTMENTS
+};
+
+// A superseded snapshot and the record slots freed while it was current. The records
+// in those slots are left intact and are tombstoned only when the slots go back to
+// the avail lists, once no reader still holds the snapshot, so every position in a
+// snapshot reads the record it had when the snapshot was published.
+struct RetiredSnapshot {
+    shared_ptr<const IndexSnapshot> snapshot;
+    vector<int> doctorSlots;
+    vector<int> appointmentSlots;
+    string blockFile;  // block store generation replaced while it was current
+};
+
+class HealthcareManagementSystem {
+
+    // Doctor and appointment storage; look keys up with findDoctor/findAppointment.
+    // Both tables hold freed slots back until no snapshot can read them, and
+    // appointment positions below zero are refs into the block store.
+    Table<DoctorSchema> doctorTable{"doctors.txt", "doctor", true};
+    Table<AppointmentSchema> appointmentTable{"appointments.txt", "appointment", true};
+    shared_ptr<AppointmentBlockStore> appointmentBlockStore = make_shared<AppointmentBlockStore>();
+    int appointmentBlockGeneration = 0;
+    AppointmentArchive appointmentArchive;
+    shared_ptr<BloomFilter> doctorFilter = make_shared<BloomFilter>();
+    shared_ptr<BloomFilter> appointmentFilter = make_shared<BloomFilter>();
+    shared_ptr<BloomFilter> doctorNameFilter = make_shared<BloomFilter>();
+    shared_ptr<BloomFilter> appointmentDoctorFilter = make_shared<BloomFilter>();
+    double bloomFalsePositiveRate = 0.01;
+
+    // Mutations are serialized by writerMutex and become visible to readers through
+    // currentSnapshot, which also carries the block store generation its refs point
+    // into. storageMutex guards the archive, which is rewritten wholesale.
+    mutex writerMutex;
+    shared_mutex storageMutex;
+    shared_ptr<const IndexSnapshot> currentSnapshot = make_shared<IndexSnapshot>();
+    deque<RetiredSnapshot> retiredSnapshots;
+    AvailabilityIndex availability;
+    mutex availabilityMutex;
+    AppointmentCounters appointmentCounters;
+    mutex countersMutex;
+    ChangeLog changeLog;
+    Table<PatientSchema> patients{"patients.txt", "patient"};
+    Table<PatientAppointmentSchema> patientAppointments{"patient_appointments.txt", "patient_appointment"};
+    static const size_t PLAN_CACHE_LIMIT = 256;
+    static const size_t JOIN_NESTED_LOOP_LIMIT = 256;
+    // Least recently used first out: hits move to the front, a full cache drops the
+    // back entry. The map's keys view the query text held by the list.
+    list<pair<string, shared_ptr<const PreparedQuery>>> planCacheOrder;
+    unordered_map<string_view, decltype(planCacheOrder)::iterator> planCache;
+    mutex planCacheMutex;
+    atomic<uint64_t> planCacheHits{0};
+    atomic<uint64_t> planCacheMisses{0};
+
+    // Replica mode: changes are pulled from the primary's log instead of the menu.
+    // replaySequence is the sequence of the entry being applied, or 0 on a primary.
+    // A pipe cannot be reread from an offset, so a reader thread queues its complete
+    // lines for catchUpReplica instead.
+    string replicaSource;
+    streamoff replicaOffset = 0;
+    uint64_t replaySequence = 0;
+    bool replicaFromPipe = false;
+    deque<string> replicaPipeLines;
+    mutex replicaPipeMutex;
+
+    const string APPOINTMENT_BLOCKS_TAG = "blocks";  // block store generation, in appointment.index
+    const string DOCTOR_BLOOM_FILE = "doctor.bloom";
+    const string APPOINTMENT_BLOOM_FILE = "appointment.bloom";
+    const string DOCTOR_NAME_BLOOM_FILE = "doctor_secondary.bloom";
+    const string APPOINTMENT_DOCTOR_BLOOM_FILE = "appointment_secondary.bloom";
+    const string SNAPSHOT_EXPORT_FILE = "snapshot.hcol";
+    const string REPLICA_STATE_FILE = "replica.state";
+
+    SecondaryIndex<DoctorSchema, DoctorSchema::NAME>& doctorSecondaryIndex() { return doctorTable.secondaryIndex<DoctorSchema::NAME>(); }
+    SecondaryIndex<AppointmentSchema, AppointmentSchema::DOCTOR_ID>& appointmentSecondaryIndex() {
+        return appointmentTable.secondaryIndex<AppointmentSchema::DOCTOR_ID>();
+    }
+    string readAppointmentRecord(int position);
+    string readAppointmentRecord(const IndexSnapshot& snap, int position);
+    static vector<string> liveBlockRecords(const IndexSnapshot& snap);
+    vector<string> coldAppointmentRecords(const IndexSnapshot& snap);
+    void scanTextFile(const IndexSnapshot& snap, bool doctors, const ScanPredicate& predicate, const function<void(string_view)>& visit);
+    void displayAppointmentRecord(const AppointmentRecord& appointment);
+    string findArchivedRecord(string_view appointmentID);
+    bool isArchived(string_view appointmentID) { return !findArchivedRecord(appointmentID).empty(); }
+    int deleteDoctorAppointments(const string& doctorID);
+    void displayDoctorRecord(const DoctorRecord& doctor);
+    void displayPatientRecord(const PatientRecord& patient);
+    void displayJoinedRecord(const AppointmentRecord& appointment, const DoctorRecord& doctor);
+    const DoctorRecord& cachedDoctor(const IndexSnapshot& snap, unordered_map<string, DoctorRecord>& cache, const string& doctorID);
+    const int* findDoctor(const string& doctorID);
+    const int* findAppointment(const string& appointmentID);
+    static const int* findInIndex(const PrimaryIndex& index, const BloomFilter& filter, BloomId id, string_view key);
+    static const PostingList* findPostings(const Postings& index, const BloomFilter& filter, BloomId id, string_view key);
+    shared_ptr<const IndexSnapshot> snapshot() const { return atomic_load(&currentSnapshot); }
+    void publishSnapshot(int changedParts);
+    void loadAvailability();
+    void loadCounters();
+    void forEachActiveAppointment(const function<void(const string&)>& visit);
+    void adjustCounters(const string& doctorID, const string& date, int delta);
+    void logChange(const vector<string>& entry);
+    void applyChange(const vector<string>& entry);
+    void saveReplicaState();
+    void followReplicaPipe();
+    bool applyReplicaLine(string line);
+    static bool appointmentSlot(const string& date, int& day, int& slot);
+    void reclaimRetiredSlots();
+    static string blockFileName(int generation);
+    void removeStaleBlockFiles();
+    void loadFilters();
+    void rebuildFilters();
+    void saveFilters();
+
+public:
+    void displayMenu();
+    void addDoctor(const string& doctorID, const string& name, const string& address);
+    void addAppointment(const string& appointmentID, const string& doctorID, const string& date);
+    void updateDoctor();
+    void updateDoctorRecord(const string& doctorID, string newName, string newAddress);
+    void updateAppointment();
+    void updateAppointmentRecord(const string& appointmentID, const string& newDate, const string& newDoctorID);
+    void searchNameForQuary(string_view doctorID);
+    void deleteDoctor();
+    void deleteDoctorByID(const string& doctorID);
+    void deleteAppointment();
+    void deleteAppointmentByID(const string& appointmentID);
+    void searchDoctorByID(string_view doctorID);
+    void searchDoctorByName();
+    void searchDoctorByName(const string& name);
+    void searchAppointmentsByID(string_view arg);
+    void searchAppointmentsByDoctorID(string_view arg);
+    void loadIndexes();
+    void saveIndexes();
+    void processQuery(const string& query);
+    shared_ptr<const PreparedQuery> prepareQuery(const string& query);
+    void executeQuery(const PreparedQuery& plan, string_view parameter = string_view());
+    void scanTable(const PreparedQuery& plan, string_view value);
+    void joinAppointments(const PreparedQuery& plan, string_view value);
+    void showStats();
+    void compressAppointments(const string& cutoffDate);
+    void archiveAppointments(const string& cutoffDate);
+    void findNextFreeSlot(const string& doctorID, const string& after);
+    void findFreeDoctors(const string& at);
+    void countAppointments(string_view doctorID);
+    void showLoadReport();
+    void exportColumnarSnapshot();
+    void addPatient(const string& patientID, const string& name, const string& phone, const string& address);
+    void updatePatient(const string& patientID, const string& newName, const string& newPhone, const string& newAddress);
+    void deletePatient(const string& patientID);
+    void linkAppointmentToPatient(const string& appointmentID, const string& patientID);
+    void searchPatientByID(const string& patientID);
+    void searchPatientsByName(const string& name);
+    void searchAppointmentsByPatientID(const string& patientID);
+    void managePatients();
+    bool startReplica(const string& source);
+    bool isReplica() const { return !replicaSource.empty(); }
+    // Turns away menu changes on a replica once their input has been read, so the
+    // remaining input stays in step; entries applied from the primary pass.
+    bool rejectOnReplica() const {
+        if (!isReplica() || replaySequence != 0)
+            return false;
+        cout << "This is a read-only replica. Make changes on the primary.\n";
+        return true;
+    }
+    void catchUpReplica();
+    void replayOperation(const vector<string>& entry);
+
+};
+
+void HealthcareManagementSystem::displayMenu() {
+    cout << "\n--- Healthcare Management System ---\n";
+    cout << "1. Add New Doctor\n";
+    cout << "2. Add New Appointment\n";
+    cout << "3. Update Doctor Name\n";
+    cout << "4. Update Appointment Date\n";
+    cout << "5. Delete Doctor\n";
+    cout << "6. Delete Appointment\n";
+    cout << "7. Search Doctor by ID\n";
+    cout << "8. Search Doctor by Name\n";
+    cout << "9. Search Appointments by Appointment ID\n";
+    cout << "10. Search Appointments by Doctor ID\n";
+    cout << "11. Write Quary\n";
+    cout << "12. Show Statistics\n";
+    cout << "13. Compress Old Appointments\n";
+    cout << "14. Archive Past Appointments\n";
+    cout << "15. Find Next Free Slot for Doctor\n";
+    cout << "16. Find Doctors Free at a Time\n";
+    cout << "17. Appointment Load Report\n";
+    cout << "18. Export Columnar Snapshot\n";
+    cout << "19. Manage Patients\n";
+    cout << "20. Exit\n";
+    cout << "Enter your choice: ";
+}
+// Primary index positions are byte offsets into appointments.txt, or (block, slot)
+// references into the compressed store when negative.
+// Writers read through the live block store; readers pass the snapshot their
+// position came from, since a compression gives refs a new meaning.
+string HealthcareManagementSystem::readAppointmentRecord(int position) {
+    if (AppointmentBlockStore::isBlockRef(position))
+        return appointmentBlockStore->readRecord(position);
+    return appointmentTable.readLine(position);
+}
+
+string HealthcareManagementSystem::readAppointmentRecord(const IndexSnapshot& snap, int position) {
+    if (AppointmentBlockStore::isBlockRef(position))
+        return snap.appointmentBlocks->readRecord(position);
+    return appointmentTable.readLine(position);
+}
+
+// Every record of the snapshot's block store that the snapshot's index still points
+// at. Deleted appointments and the old copies of updated or archived ones stay in
+// their block until the next compression and are skipped.
+vector<string> HealthcareManagementSystem::liveBlockRecords(const IndexSnapshot& snap) {
+    vector<string> records;
+    for (auto& entry : snap.appointmentBlocks->readAll()) {
+        const int* pos = snap.appointmentPrimary->find(stringPool.find(string_view(entry.second).substr(0, entry.second.find('|'))));
+        if (pos && *pos == entry.first)
+            records.push_back(move(entry.second));
+    }
+    return records;
+}
+
+// The live block records of snap followed by the archived appointments, as
+// "id|date|doctorID". Appointments archived after snap was taken are still in its
+// index and are left to the text or block side, so none is returned twice.
+vector<string> HealthcareManagementSystem::coldAppointmentRecords(const IndexSnapshot& snap) {
+    vector<string> records = liveBlockRecords(snap);
+    shared_lock<shared_mutex> storageLock(storageMutex);
+    for (auto& entry : appointmentArchive.store.readAll()) {
+        string_view id = string_view(entry.second).substr(0, entry.second.find('|'));
+        if (!snap.appointmentPrimary->find(stringPool.find(id)))
+            records.push_back(move(entry.second));
+    }
+    return records;
+}
+
+// Visits the records of the doctor or appointment text file that are live in snap and
+// match the predicate, without their length prefix. No lock is held while the file is
+// read: writes never touch a record snap can reach, so each is seen as of snap.
+void HealthcareManagementSystem::scanTextFile(const IndexSnapshot& snap, bool doctors, const ScanPredicate& predicate, const function<void(string_view)>& visit) {
+    const auto& primary = doctors ? *snap.doctorPrimary : *snap.appointmentPrimary;
+    vector<int> live;
+    live.reserve(primary.size());
+    for (const auto& entry : primary) {
+        if (!AppointmentBlockStore::isBlockRef(entry.second))
+            live.push_back(entry.second);
+    }
+    sort(live.begin(), live.end());
+    scanLiveRecords(doctors ? doctorTable.DATA_FILE : appointmentTable.DATA_FILE, live, predicate, OP_PROCESS_QUERY, visit);
+}
+
+void HealthcareManagementSystem::addDoctor(const string& doctorID, const string& name, const string& address) {
+    if (rejectOnReplica())
+        return;
+    lock_guard<mutex> lock(writerMutex);
+    TraceScope trace("add_doctor", {doctorID, name, address});
+    DoctorRecord doctor{{doctorID, name, address}};
+    if (const char* error = doctor.validate()) {
+        cout << error << "\n";
+        return;
+    }
+    if (findDoctor(doctorID)) {
+        cout << "Doctor with this ID already exists.\n";
+        return;
+    }
+    if (const char* error = doctorTable.insert(doctor)) {
+        cout << error << "\n";
+        return;
+    }
+    doctorFilter->add(doctorID);
+    doctorNameFilter->add(name);
+    {
+        lock_guard<mutex> availabilityLock(availabilityMutex);
+        availability.addDoctor(doctorID);
+    }
+    saveIndexes();
+    publishSnapshot(SNAPSHOT_DOCTORS);
+    logChange({"add_doctor", doctorID, name, address});
+
+    cout << "Doctor added successfully.\n";
+}
+
+
+void HealthcareManagementSystem::deleteDoctor() {
     string doctorID;
     cout << "Enter Doctor ID to delete: ";
     cin >> doctorID;
-    int pos = binarySearch(doctorPrimaryIndex, doctorID);
-    if (pos == -1) {
+    deleteDoctorByID(doctorID);
+}
+
+void HealthcareManagementSystem::deleteDoctorByID(const string& doctorID) {
+    if (rejectOnReplica())
+        return;
+    lock_guard<mutex> lock(writerMutex);
+    TraceScope trace("delete_doctor", {doctorID});
+    if (!findDoctor(doctorID)) {
         cout << "Doctor not found.\n";
         return;
     }
-    string doctorIDToDelete = doctorPrimaryIndex[pos].first;
-    int recordPosition = doctorPrimaryIndex[pos].second;
-    string record = readRecordFromFile(DOCTOR_FILE, recordPosition);
-    size_t d1 = record.find('|');
-    size_t d2 = record.find('|', d1 + 1);
-    string name = record.substr(d1 + 1, d2 - d1 - 1);
-    markDeleted(doctorAvailList, recordPosition, DOCTOR_FILE);
-    doctorPrimaryIndex.erase(doctorPrimaryIndex.begin() + pos);
+    int appointmentsDeleted = deleteDoctorAppointments(doctorID);
+    doctorTable.remove(doctorID);
+    {
+        lock_guard<mutex> availabilityLock(availabilityMutex);
+        availability.removeDoctor(doctorID);
+    }
     saveIndexes();
-    doctorSecondaryIndex.remove(name, doctorID);
-    doctorSecondaryIndex.save();
+    publishSnapshot(appointmentsDeleted ? SNAPSHOT_ALL : SNAPSHOT_DOCTORS);
+    logChange({"delete_doctor", doctorID});
 
     cout << "Doctor deleted successfully.\n";
+    if (appointmentsDeleted)
+        cout << appointmentsDeleted << " appointments for this doctor were deleted.\n";
+}
+
+// Cascades a doctor delete to the doctor's active appointments: reads and releases
+// the text records in one offset-ordered pass each, then detaches the whole posting
+// list from the secondary index and erases the primary index entries. The caller
+// persists the indexes once afterwards. Archived appointments are history and stay
+// untouched. Returns the number of appointments deleted.
+int HealthcareManagementSystem::deleteDoctorAppointments(const string& doctorID) {
+    const PostingList* postings = appointmentSecondaryIndex().postings.find(stringPool.find(doctorID));
+    if (!postings)
+        return 0;
+
+    vector<StringHandle> doomed;
+    vector<int> textPositions;
+    vector<string> dates;
+    for (StringHandle appointmentID : **postings) {
+        const int* position = appointmentTable.position(stringPool.str(appointmentID));
+        if (!position)
+            continue;
+        doomed.push_back(appointmentID);
+        if (AppointmentBlockStore::isBlockRef(*position))
+            dates.push_back(AppointmentRecord::fromStored(readAppointmentRecord(*position)).get<AppointmentSchema::DATE>());
+        else
+            textPositions.push_back(*position);
+    }
+    for (const auto& line : appointmentTable.readLines(textPositions))
+        dates.push_back(AppointmentRecord::fromStored(line.second).get<AppointmentSchema::DATE>());
+    appointmentTable.release(textPositions);
+    appointmentSecondaryIndex().take(doctorID);
+    for (StringHandle appointmentID : doomed)
+        appointmentTable.erasePosition(stringPool.str(appointmentID));
+    {
+        lock_guard<mutex> availabilityLock(availabilityMutex);
+        for (const string& date : dates) {
+            int day, slot;
+            if (appointmentSlot(date, day, slot))
+                availability.release(doctorID, day, slot);
+        }
+    }
+    for (const string& date : dates)
+        adjustCounters(doctorID, date, -1);
+    bool unlinked = false;
+    for (StringHandle appointmentID : doomed)
+        unlinked = patientAppointments.remove(string(stringPool.str(appointmentID))) || unlinked;
+    if (unlinked)
+        patientAppointments.save();
+    return doomed.size();
+}
+
+void HealthcareManagementSystem::searchDoctorByID(string_view doctorID) {
+    TraceScope trace("search_doctor", {doctorID});
+    auto snap = snapshot();
+    const int* position = findInIndex(*snap->doctorPrimary, *snap->doctorFilter, BLOOM_DOCTOR, doctorID);
+    if (!position) {
+        cout << "Doctor not found.\n";
+        return;
+    }
+    displayDoctorRecord(DoctorRecord::fromStored(doctorTable.readLine(*position)));
+}
+
+void HealthcareManagementSystem::displayDoctorRecord(const DoctorRecord& doctor) {
+    cout << "\n--- Doctor Details ---\n";
+    cout << "Doctor ID: " << doctor.get<DoctorSchema::ID>() << "\n";
+    cout << "Name: " << doctor.get<DoctorSchema::NAME>() << "\n";
+    cout << "Address: " << doctor.get<DoctorSchema::ADDRESS>() << "\n";
+    cout << "-----------------------\n";
+}
+void HealthcareManagementSystem::searchDoctorByName() {
+    string name;
+    cout << "Enter Doctor Name to search: ";
+    cin.ignore();
+    getline(cin, name);
+    searchDoctorByName(name);
+}
+
+void HealthcareManagementSystem::searchDoctorByName(const string& name) {
+    TraceScope trace("search_doctor_name", {name});
+    auto snap = snapshot();
+    const PostingList* ids = findPostings(*snap->doctorsByName, *snap->doctorNameFilter, BLOOM_DOCTOR_NAME, name);
+    if (!ids || (*ids)->empty()) {
+        cout << "No doctors found with the name: " << name << endl;
+        return;
+    }
+
+    for (StringHandle id : **ids) {
+        const int* pos = snap->doctorPrimary->find(id);
+        if (pos) {
+            displayDoctorRecord(DoctorRecord::fromStored(doctorTable.readLine(*pos)));
+        }
+    }
+}
+
+void HealthcareManagementSystem::deleteAppointment() {
+    string appointmentID;
+    cout << "Enter Appointment ID to delete: ";
+    cin >> appointmentID;
+    deleteAppointmentByID(appointmentID);
+}
+
+void HealthcareManagementSystem::deleteAppointmentByID(const string& appointmentID) {
+    if (rejectOnReplica())
+        return;
+    lock_guard<mutex> lock(writerMutex);
+    TraceScope trace("delete_appointment", {appointmentID});
+    const int* pos = findAppointment(appointmentID);
+    if (!pos && appointmentArchive.mightContain(appointmentID) && isArchived(appointmentID)) {
+        cout << "Archived appointments are read-only.\n";
+        return;
+    }
+    if (!pos) {
+        cout << "Appointment not found.\n";
+        return;
+    }
+    int recordPosition = *pos;
+    AppointmentRecord appointment = AppointmentRecord::fromStored(readAppointmentRecord(recordPosition));
+    const string& doctorID = appointment.get<AppointmentSchema::DOCTOR_ID>();
+    // Compressed records are immutable; dropping the index entry is enough and the
+    // block space is reclaimed by the next compression run.
+    if (!AppointmentBlockStore::isBlockRef(recordPosition))
+        appointmentTable.release({recordPosition});
+    int day, slot;
+    if (appointmentSlot(appointment.get<AppointmentSchema::DATE>(), day, slot)) {
+        lock_guard<mutex> availabilityLock(availabilityMutex);
+        availability.release(doctorID, day, slot);
+    }
+    adjustCounters(doctorID, appointment.get<AppointmentSchema::DATE>(), -1);
+    appointmentTable.erasePosition(appointmentID);
+    appointmentSecondaryIndex().remove(doctorID, appointmentID);
+    saveIndexes();
+    if (patientAppointments.remove(appointmentID))
+        patientAppointments.save();
+    publishSnapshot(SNAPSHOT_APPOINTMENTS);
+    logChange({"delete_appointment", appointmentID});
+    cout << "Appointment deleted successfully.\n";
+}
+
+
+
+void HealthcareManagementSystem::addAppointment(const string& appointmentID, const string& doctorID, const string& date) {
+    if (rejectOnReplica())
+        return;
+    lock_guard<mutex> lock(writerMutex);
+    TraceScope trace("add_appointment", {appointmentID, doctorID, date});
+    AppointmentRecord appointment{{appointmentID, date, doctorID}};
+    if (const char* error = appointment.validate()) {
+        cout << error << "\n";
+        return;
+    }
+    if (!findDoctor(doctorID)) {
+        cout << "Error: Doctor ID does not exist. Please add the doctor before adding an appointment.\n";
+        return;
+    }
+    bool archived;
+    {
+        shared_lock<shared_mutex> storageLock(storageMutex);
+        archived = !appointmentArchive.find(appointmentID).empty();
+    }
+    if (findAppointment(appointmentID) || archived) {
+        cout << "Appointment with this ID already exists.\n";
+        return;
+    }
+    int day, slot;
+    bool hasSlot = appointmentSlot(date, day, slot);
+    if (hasSlot) {
+        lock_guard<mutex> availabilityLock(availabilityMutex);
+        if (availability.isBooked(doctorID, day, slot)) {
+            cout << "Error: Doctor " << doctorID << " is already booked at " << date << ".\n";
+            return;
+        }
+    }
+    if (const char* error = appointmentTable.insert(appointment)) {
+        cout << error << "\n";
+        return;
+    }
+    appointmentFilter->add(appointmentID);
+    appointmentDoctorFilter->add(doctorID);
+    if (hasSlot) {
+        lock_guard<mutex> availabilityLock(availabilityMutex);
+        availability.book(doctorID, day, slot);
+    }
+    adjustCounters(doctorID, date, +1);
+    saveIndexes();
+    publishSnapshot(SNAPSHOT_APPOINTMENTS);
+    logChange({"add_appointment", appointmentID, doctorID, date});
+    cout << "Appointment added successfully.\n";
+}
+
+void HealthcareManagementSystem::updateAppointment() {
+    string appointmentID, newDate, newDoctorID;
+    cout << "Enter Appointment ID to update: ";
+    cin >> appointmentID;
+    auto snap = snapshot();
+    if (appointmentID.length() <= 15 &&
+        findInIndex(*snap->appointmentPrimary, *snap->appointmentFilter, BLOOM_APPOINTMENT, appointmentID)) {
+        cout << "Enter new appointment date (leave blank to skip): ";
+        cin.ignore();
+        getline(cin, newDate);
+        cout << "Enter new doctor ID (leave blank to skip): ";
+        getline(cin, newDoctorID);
+    }
+    updateAppointmentRecord(appointmentID, newDate, newDoctorID);
+}
+
+void HealthcareManagementSystem::updateAppointmentRecord(const string& appointmentID, const string& newDate, const string& newDoctorID) {
+    if (rejectOnReplica())
+        return;
+    lock_guard<mutex> lock(writerMutex);
+    TraceScope trace("update_appointment", {appointmentID, newDate, newDoctorID});
+    if (appointmentID.length() > 15 ) {
+        cout << "Error: Input exceeds the maximum allowed length.\n";
+        return;
+    }
+    const int* pos = findAppointment(appointmentID);
+    if (!pos && appointmentArchive.mightContain(appointmentID) && isArchived(appointmentID)) {
+        cout << "Archived appointments are read-only.\n";
+        return;
+    }
+    if (!pos) {
+        cout << "Appointment not found.\n";
+        return;
+    }
+    int recordPosition = *pos;
+    AppointmentRecord appointment = AppointmentRecord::fromStored(readAppointmentRecord(recordPosition));
+    string& date = appointment.get<AppointmentSchema::DATE>();
+    string& doctorID = appointment.get<AppointmentSchema::DOCTOR_ID>();
+    string oldDate = date;
+    string oldDoctorID = doctorID;
+    if (!newDate.empty()) {
+        date = newDate;
+    }
+    string targetDoctorID = newDoctorID.empty() ? doctorID : newDoctorID;
+    if (targetDoctorID != oldDoctorID && !findDoctor(targetDoctorID)) {
+        cout << "Error: Doctor ID does not exist. Please add the doctor before moving an appointment to it.\n";
+        return;
+    }
+    int oldDay, oldSlot, newDay, newSlot;
+    bool hadSlot = appointmentSlot(oldDate, oldDay, oldSlot);
+    bool hasSlot = appointmentSlot(date, newDay, newSlot);
+    bool sameSlot = hadSlot && hasSlot && oldDay == newDay && oldSlot == newSlot && targetDoctorID == oldDoctorID;
+    AppointmentRecord updated{{appointment.key(), date, targetDoctorID}};
+    if (const char* error = updated.validate()) {
+        cout << error << "\n";
+        return;
+    }
+    if (hasSlot && !sameSlot) {
+        lock_guard<mutex> availabilityLock(availabilityMutex);
+        if (availability.isBooked(targetDoctorID, newDay, newSlot)) {
+            cout << "Error: Doctor " << targetDoctorID << " is already booked at " << date << ".\n";
+            return;
+        }
+    }
+    // Updating a compressed appointment moves it back to the text file.
+    int written = AppointmentBlockStore::isBlockRef(recordPosition) ? appointmentTable.write(updated)
+                                                                   : appointmentTable.rewrite(recordPosition, updated);
+    if (written < 0) {
+        cerr << "Error: Unable to open " << appointmentTable.DATA_FILE << "\n";
+        return;
+    }
+    appointmentTable.setPosition(appointmentID, written);
+    if (!newDoctorID.empty() && newDoctorID != doctorID) {
+        appointmentSecondaryIndex().remove(doctorID, appointmentID);
+        appointmentSecondaryIndex().add(newDoctorID, appointmentID);
+        appointmentDoctorFilter->add(newDoctorID);
+        doctorID = newDoctorID;
+    }
+    if (!sameSlot) {
+        lock_guard<mutex> availabilityLock(availabilityMutex);
+        if (hadSlot)
+            availability.release(oldDoctorID, oldDay, oldSlot);
+        if (hasSlot)
+            availability.book(doctorID, newDay, newSlot);
+    }
+    if (oldDate != date || oldDoctorID != doctorID) {
+        adjustCounters(oldDoctorID, oldDate, -1);
+        adjustCounters(doctorID, date, +1);
+    }
+    saveIndexes();
+    publishSnapshot(SNAPSHOT_APPOINTMENTS);
+    logChange({"update_appointment", appointmentID, newDate, newDoctorID});
+    cout << "Appointment updated successfully.\n";
+}
+
+void HealthcareManagementSystem::searchAppointmentsByID(string_view arg = string_view()) {
+    string input;
+    if (arg.empty()) {
+        cout << "Enter Appointment ID to search: ";
+        cin >> input;
+        arg = input;
+    }
+    string_view appointmentID = arg;
+    TraceScope trace("search_appointment", {appointmentID});
+    auto snap = snapshot();
+    const int* position = findInIndex(*snap->appointmentPrimary, *snap->appointmentFilter, BLOOM_APPOINTMENT, appointmentID);
+    string record;
+    if (position) {
+        record = readAppointmentRecord(*snap, *position);
+    } else {
+        record = findArchivedRecord(appointmentID);
+        if (record.empty()) {
+            cout << "Appointment not found.\n";
+            return;
+        }
+    }
+    if (record.empty()) {
+        cout << "Error: Unable to retrieve appointment record.\n";
+        return;
+    }
+    displayAppointmentRecord(AppointmentRecord::fromStored(record));
+}
+
+string HealthcareManagementSystem::findArchivedRecord(string_view appointmentID) {
+    shared_lock<shared_mutex> lock(storageMutex);
+    return appointmentArchive.find(appointmentID);
+}
+
+void HealthcareManagementSystem::displayAppointmentRecord(const AppointmentRecord& appointment) {
+    cout << "\n--- Appointment Details ---\n";
+    cout << "Appointment ID: " << appointment.get<AppointmentSchema::ID>() << "\n";
+    cout << "Date: " << appointment.get<AppointmentSchema::DATE>() << "\n";
+    cout << "Doctor ID: " << appointment.get<AppointmentSchema::DOCTOR_ID>() << "\n";
+    cout << "---------------------------\n";
+}
+void HealthcareManagementSystem::searchAppointmentsByDoctorID(string_view arg = string_view()) {
+    string input;
+    if (arg.empty()) {
+        cout << "Enter Doctor ID to search: ";
+        cin >> input;
+        arg = input;
+    }
+    string_view doctorID = arg;
+    TraceScope trace("search_doctor_appointments", {doctorID});
+    auto snap = snapshot();
+    const PostingList* hot = findPostings(*snap->appointmentsByDoctor, *snap->appointmentDoctorFilter, BLOOM_APPOINTMENT_DOCTOR, doctorID);
+    vector<string> archived;
+    {
+        shared_lock<shared_mutex> lock(storageMutex);
+        archived = appointmentArchive.findByDoctor(doctorID);
+    }
+    bool hasHot = hot && !(*hot)->empty();
+    if (!hasHot && archived.empty()) {
+        cout << "No appointments found for Doctor ID: " << doctorID << endl;
+        return;
+    }
+    cout << "\nAppointments for Doctor ID: " << doctorID << "\n";
+    for (const string& appointmentID : archived) {
+        string record = findArchivedRecord(appointmentID);
+        if (!record.empty())
+            displayAppointmentRecord(AppointmentRecord::fromStored(record));
+    }
+    for (StringHandle currentID : hasHot ? **hot : vector<StringHandle>()) {
+        const int* pos = snap->appointmentPrimary->find(currentID);
+        if (pos) {
+            string record = readAppointmentRecord(*snap, *pos);
+            if (!record.empty()) {
+                displayAppointmentRecord(AppointmentRecord::fromStored(record));
+            } else {
+                cout << "Error: Unable to read record for Appointment ID: " << stringPool.str(currentID) << "\n";
+            }
+        } else {
+            cout << "Warning: Appointment ID " << stringPool.str(currentID) << " not found in primary index.\n";
+        }
+    }
+}
+
+
+void HealthcareManagementSystem::loadIndexes() {
+    ScopedTimer timer(OP_LOAD_INDEXES);
+    doctorTable.load();
+    appointmentTable.load();
+    appointmentBlockGeneration = atoi(appointmentTable.tag(APPOINTMENT_BLOCKS_TAG).c_str());
+    appointmentBlockStore = make_shared<AppointmentBlockStore>(blockFileName(appointmentBlockGeneration));
+    appointmentBlockStore->load();
+    removeStaleBlockFiles();
+    appointmentArchive.load();
+    loadFilters();
+    loadAvailability();
+    loadCounters();
+    changeLog.load();
+    patients.load();
+    patientAppointments.load();
+    publishSnapshot(SNAPSHOT_ALL);
+}
+
+bool HealthcareManagementSystem::appointmentSlot(const string& date, int& day, int& slot) {
+    ParsedDate parsed;
+    if (!parseDate(date, parsed) || parsed.minuteOfDay < 0)
+        return false;
+    day = parsed.days;
+    slot = parsed.minuteOfDay / AvailabilityIndex::SLOT_MINUTES;
+    return true;
+}
+
+// Rebuilds the slot bitmaps from the active appointments in one pass over the
+// appointment file, visiting records in file order. Archived appointments are in
+// the past and do not take part in availability.
+void HealthcareManagementSystem::loadAvailability() {
+    lock_guard<mutex> availabilityLock(availabilityMutex);
+    availability.clear();
+    for (const auto& entry : doctorTable.positions())
+        availability.addDoctor(string(stringPool.str(entry.first)));
+    forEachActiveAppointment([this](const string& record) {
+        AppointmentRecord appointment = AppointmentRecord::fromStored(record);
+        int day, slot;
+        if (appointmentSlot(appointment.get<AppointmentSchema::DATE>(), day, slot))
+            availability.book(appointment.get<AppointmentSchema::DOCTOR_ID>(), day, slot);
+    });
+}
+
+// Visits every active (non-archived) appointment record: the compressed ones, then
+// the text file in offset order through a single handle. Records keep their length
+// prefix.
+void HealthcareManagementSystem::forEachActiveAppointment(const function<void(const string&)>& visit) {
+    vector<int> textPositions;
+    for (const auto& entry : appointmentTable.positions()) {
+        if (!AppointmentBlockStore::isBlockRef(entry.second)) {
+            textPositions.push_back(entry.second);
+            continue;
+        }
+        string record = readAppointmentRecord(entry.second);
+        if (record.length() > 4)
+            visit(record);
+    }
+    for (const auto& line : appointmentTable.readLines(textPositions)) {
+        if (line.second.length() > 4 && line.second.back() != '*')
+            visit(line.second);
+    }
+}
+
+void HealthcareManagementSystem::adjustCounters(const string& doctorID, const string& date, int delta) {
+    lock_guard<mutex> countersLock(countersMutex);
+    appointmentCounters.adjust(doctorID, date, delta);
+}
+
+// Uses the persisted counters when they are consistent, otherwise recounts the
+// active appointments and the archive once.
+void HealthcareManagementSystem::loadCounters() {
+    lock_guard<mutex> countersLock(countersMutex);
+    if (appointmentCounters.load())
+        return;
+    appointmentCounters.clear();
+    auto count = [this](const AppointmentRecord& appointment) {
+        appointmentCounters.adjust(appointment.get<AppointmentSchema::DOCTOR_ID>(), appointment.get<AppointmentSchema::DATE>(), +1);
+    };
+    forEachActiveAppointment([&count](const string& record) { count(AppointmentRecord::fromStored(record)); });
+    shared_lock<shared_mutex> storageLock(storageMutex);
+    for (const auto& entry : appointmentArchive.store.readAll())
+        count(AppointmentRecord::parse(entry.second));
+    appointmentCounters.save();
+}
+
+void HealthcareManagementSystem::saveIndexes() {
+    ScopedTimer timer(OP_SAVE_INDEXES);
+    // Slots still pinned by a reader's snapshot are free as far as the next run is concerned.
+    vector<int> doctorSlots;
+    vector<int> appointmentSlots;
+    for (const auto& retired : retiredSnapshots) {
+        doctorSlots.insert(doctorSlots.end(), retired.doctorSlots.begin(), retired.doctorSlots.end());
+        appointmentSlots.insert(appointmentSlots.end(), retired.appointmentSlots.begin(), retired.appointmentSlots.end());
+    }
+    doctorTable.save(doctorSlots);
+    appointmentTable.save(appointmentSlots);
+    saveFilters();
+    {
+        lock_guard<mutex> countersLock(countersMutex);
+        appointmentCounters.save();
+    }
+}
+
+// Writer-side lookups against the live indexes; callers hold writerMutex.
+const int* HealthcareManagementSystem::findDoctor(const string& doctorID) {
+    return findInIndex(doctorTable.positions(), *doctorFilter, BLOOM_DOCTOR, doctorID);
+}
+
+const int* HealthcareManagementSystem::findAppointment(const string& appointmentID) {
+    return findInIndex(appointmentTable.positions(), *appointmentFilter, BLOOM_APPOINTMENT, appointmentID);
+}
+
+// Returns the key's record position, or nullptr when it is not in the index. A key
+// that was never interned cannot be in any index, so the search is skipped.
+const int* HealthcareManagementSystem::findInIndex(const PrimaryIndex& index, const BloomFilter& filter, BloomId id, string_view key) {
+    bool maybe = filter.mightContain(key);
+    metrics.recordBloomCheck(id, maybe);
+    if (!maybe)
+        return nullptr;
+    StringHandle handle = stringPool.find(key);
+    const int* pos = handle == StringPool::NONE ? nullptr : index.find(handle);
+    if (!pos)
+        metrics.recordBloomFalsePositive(id);
+    return pos;
+}
+
+// The posting list of a secondary key, or nullptr when it has none.
+const PostingList* HealthcareManagementSystem::findPostings(const Postings& index, const BloomFilter& filter, BloomId id, string_view key) {
+    bool maybe = filter.mightContain(key);
+    metrics.recordBloomCheck(id, maybe);
+    if (!maybe)
+        return nullptr;
+    StringHandle handle = stringPool.find(key);
+    const PostingList* list = handle == StringPool::NONE ? nullptr : index.find(handle);
+    if (!list)
+        metrics.recordBloomFalsePositive(id);
+    return list;
+}
+
+// Publishes a new snapshot, copying only the parts named in changedParts, then
+// retires the previous one together with the slots freed while it was current.
+// Copying an index copies its chunk pointers, not its entries.
+void HealthcareManagementSystem::publishSnapshot(int changedParts) {
+    auto previous = snapshot();
+    auto next = make_shared<IndexSnapshot>(*previous);
+    next->version = previous->version + 1;
+    if ((changedParts & SNAPSHOT_DOCTORS) || !next->doctorPrimary) {
+        next->doctorPrimary = make_shared<const PrimaryIndex>(doctorTable.positions());
+        next->doctorsByName = make_shared<const Postings>(doctorSecondaryIndex().postings);
+    }
+    if ((changedParts & SNAPSHOT_APPOINTMENTS) || !next->appointmentPrimary) {
+        next->appointmentPrimary = make_shared<const PrimaryIndex>(appointmentTable.positions());
+        next->appointmentsByDoctor = make_shared<const Postings>(appointmentSecondaryIndex().postings);
+    }
+    next->doctorFilter = doctorFilter;
+    next->appointmentFilter = appointmentFilter;
+    next->doctorNameFilter = doctorNameFilter;
+    next->appointmentDoctorFilter = appointmentDoctorFilter;
+    next->appointmentBlocks = appointmentBlockStore;
+    atomic_store(&currentSnapshot, shared_ptr<const IndexSnapshot>(next));
+
+    string replacedBlockFile;
+    if (previous->appointmentBlocks && previous->appointmentBlocks != next->appointmentBlocks)
+        replacedBlockFile = previous->appointmentBlocks->BLOCK_FILE;
+    retiredSnapshots.push_back({previous, doctorTable.takeFreedSlots(), appointmentTable.takeFreedSlots(), replacedBlockFile});
+    previous.reset();
+    reclaimRetiredSlots();
+}
+
+// Tombstones freed slots and returns them to the avail lists, and deletes replaced
+// block store files, once every older snapshot is unreferenced.
+// Readers only ever obtain the current snapshot, so a retired one whose only owner
+// is this list can never be picked up again.
+void HealthcareManagementSystem::reclaimRetiredSlots() {
+    while (!retiredSnapshots.empty() && retiredSnapshots.front().snapshot.use_count() == 1) {
+        RetiredSnapshot& retired = retiredSnapshots.front();
+        doctorTable.reuseSlots(retired.doctorSlots);
+        appointmentTable.reuseSlots(retired.appointmentSlots);
+        if (!retired.blockFile.empty())
+            remove(retired.blockFile.c_str());
+        retiredSnapshots.pop_front();
+    }
+}
+
+string HealthcareManagementSystem::blockFileName(int generation) {
+    return generation == 0 ? "appointments.blk" : "appointments." + to_string(generation) + ".blk";
+}
+
+// Deletes block store generations other than the one appointment.index names, left
+// behind by earlier compressions or by one interrupted before the index was saved.
+void HealthcareManagementSystem::removeStaleBlockFiles() {
+    error_code error;
+    for (const auto& entry : filesystem::directory_iterator(".", error)) {
+        string name = entry.path().filename().string();
+        bool generationFile = name.size() > 17 && name.compare(0, 13, "appointments.") == 0 &&
+                              name.compare(name.size() - 4, 4, ".blk") == 0 &&
+                              name.find_first_not_of("0123456789", 13) == name.size() - 4;
+        if ((generationFile || name == blockFileName(0)) && name != appointmentBlockStore->BLOCK_FILE)
+            filesystem::remove(entry.path(), error);
+    }
+}
+
+// Loads the persisted filters and rebuilds any that are missing, stale or sized for
+// a different false-positive rate. The rate can be overridden with HCMS_BLOOM_FP_RATE.
+void HealthcareManagementSystem::loadFilters() {
+    const char* configuredRate = getenv("HCMS_BLOOM_FP_RATE");
+    if (configuredRate) {
+        double rate = atof(configuredRate);
+        if (rate > 0.0 && rate < 1.0)
+            bloomFalsePositiveRate = rate;
+        else
+            cerr << "Warning: ignoring invalid HCMS_BLOOM_FP_RATE " << configuredRate << endl;
+    }
+    doctorFilter->falsePositiveRate = bloomFalsePositiveRate;
+    appointmentFilter->falsePositiveRate = bloomFalsePositiveRate;
+    doctorNameFilter->falsePositiveRate = bloomFalsePositiveRate;
+    appointmentDoctorFilter->falsePositiveRate = bloomFalsePositiveRate;
+
+    bool loaded = doctorFilter->load(DOCTOR_BLOOM_FILE) && appointmentFilter->load(APPOINTMENT_BLOOM_FILE) &&
+                  doctorNameFilter->load(DOCTOR_NAME_BLOOM_FILE) && appointmentDoctorFilter->load(APPOINTMENT_DOCTOR_BLOOM_FILE);
+    if (!loaded || doctorFilter->needsRebuild(doctorTable.positions().size()) ||
+        appointmentFilter->needsRebuild(appointmentTable.positions().size()) ||
+        doctorNameFilter->needsRebuild(doctorSecondaryIndex().postings.size()) ||
+        appointmentDoctorFilter->needsRebuild(appointmentSecondaryIndex().postings.size())) {
+        rebuildFilters();
+    }
+}
+
+// Builds fresh filter objects rather than resetting the current ones, which readers
+// may still be probing through an older snapshot.
+void HealthcareManagementSystem::rebuildFilters() {
+    doctorFilter = make_shared<BloomFilter>();
+    doctorFilter->reset(doctorTable.positions().size(), bloomFalsePositiveRate);
+    for (const auto& entry : doctorTable.positions())
+        doctorFilter->add(string(stringPool.str(entry.first)));
+    appointmentFilter = make_shared<BloomFilter>();
+    appointmentFilter->reset(appointmentTable.positions().size(), bloomFalsePositiveRate);
+    for (const auto& entry : appointmentTable.positions())
+        appointmentFilter->add(string(stringPool.str(entry.first)));
+    doctorNameFilter = make_shared<BloomFilter>();
+    doctorNameFilter->reset(doctorSecondaryIndex().postings.size(), bloomFalsePositiveRate);
+    for (const auto& entry : doctorSecondaryIndex().postings)
+        doctorNameFilter->add(string(stringPool.str(entry.first)));
+    appointmentDoctorFilter = make_shared<BloomFilter>();
+    appointmentDoctorFilter->reset(appointmentSecondaryIndex().postings.size(), bloomFalsePositiveRate);
+    for (const auto& entry : appointmentSecondaryIndex().postings)
+        appointmentDoctorFilter->add(string(stringPool.str(entry.first)));
+}
+
+// Called on every index save, which doubles as the compaction point for the filters.
+void HealthcareManagementSystem::saveFilters() {
+    if (doctorFilter->needsRebuild(doctorTable.positions().size()) ||
+        appointmentFilter->needsRebuild(appointmentTable.positions().size()) ||
+        doctorNameFilter->needsRebuild(doctorSecondaryIndex().postings.size()) ||
+        appointmentDoctorFilter->needsRebuild(appointmentSecondaryIndex().postings.size())) {
+        rebuildFilters();
+    }
+    doctorFilter->save(DOCTOR_BLOOM_FILE);
+    appointmentFilter->save(APPOINTMENT_BLOOM_FILE);
+    doctorNameFilter->save(DOCTOR_NAME_BLOOM_FILE);
+    appointmentDoctorFilter->save(APPOINTMENT_DOCTOR_BLOOM_FILE);
+}
+
+
+void HealthcareManagementSystem::updateDoctor() {
+    string doctorID, newName, newAddress;
+    cout << "Enter Doctor ID to update: ";
+    cin >> doctorID;
+    auto snap = snapshot();
+    if (findInIndex(*snap->doctorPrimary, *snap->doctorFilter, BLOOM_DOCTOR, doctorID)) {
+        cout << "Enter new name (leave blank to keep current): ";
+        cin.ignore();
+        getline(cin, newName);
+        cout << "Enter new address (leave blank to keep current): ";
+        getline(cin, newAddress);
+    }
+    updateDoctorRecord(doctorID, newName, newAddress);
+}
+
+// Blank fields keep their current value.
+void HealthcareManagementSystem::updateDoctorRecord(const string& doctorID, string newName, string newAddress) {
+    if (rejectOnReplica())
+        return;
+    lock_guard<mutex> lock(writerMutex);
+    TraceScope trace("update_doctor", {doctorID, newName, newAddress});
+    const int* pos = findDoctor(doctorID);
+    if (!pos) {
+        cout << "Doctor not found.\n";
+        return;
+    }
+    string record = doctorTable.readLine(*pos);
+    if (record.empty()) {
+        cout << "Error reading the doctor record.\n";
+        return;
+    }
+    DoctorRecord doctor = DoctorRecord::fromStored(record);
+    string name = doctor.get<DoctorSchema::NAME>();
+    string address = doctor.get<DoctorSchema::ADDRESS>();
+    vector<string> change = {"update_doctor", doctorID, newName, newAddress};
+    if (newName.empty()) {
+        newName = name;
+    }
+    if (newAddress.empty()) {
+        newAddress = address;
+    }
+    DoctorRecord updated{{doctorID, newName, newAddress}};
+    if (const char* error = updated.validate()) {
+        cout << error << "\n";
+        return;
+    }
+    if (const char* error = doctorTable.update(updated)) {
+        cout << error << "\n";
+        return;
+    }
+    doctorNameFilter->add(newName);
+    saveIndexes();
+    publishSnapshot(SNAPSHOT_DOCTORS);
+    logChange(change);
+    cout << "Doctor record updated successfully.\n";
+}
+void HealthcareManagementSystem::searchNameForQuary(string_view doctorID) {
+    auto snap = snapshot();
+    StringHandle target = stringPool.find(doctorID);
+    for (const auto& entry : *snap->doctorsByName) {
+        // Each entry maps a doctor name to the IDs of the doctors with that name
+        for (StringHandle id : *entry.second) {
+            // If we find the doctorID in the secondary index, we found the name
+            if (id == target) {
+                cout << stringPool.str(entry.first) << "\n";
+                return;
+            }
+        }
+    }
+
+    // If we reach here, no doctor with the specified ID was found in the secondary index
+    cout << "No doctor found with the ID: " << doctorID << endl;
+}
+
+// Plans are cached by query text, so repeated queries skip parsing entirely.
+shared_ptr<const PreparedQuery> HealthcareManagementSystem::prepareQuery(const string& query) {
+    {
+        lock_guard<mutex> cacheLock(planCacheMutex);
+        auto it = planCache.find(query);
+        if (it != planCache.end()) {
+            planCacheHits.fetch_add(1, memory_order_relaxed);
+            planCacheOrder.splice(planCacheOrder.begin(), planCacheOrder, it->second);
+            return it->second->second;
+        }
+    }
+    planCacheMisses.fetch_add(1, memory_order_relaxed);
+    auto plan = make_shared<PreparedQuery>();
+    if (const char* error = parseQuery(query, *plan)) {
+        cout << error << "\n";
+        return nullptr;
+    }
+    lock_guard<mutex> cacheLock(planCacheMutex);
+    if (planCache.count(query))
+        return plan;  // prepared by another thread meanwhile
+    if (planCache.size() >= PLAN_CACHE_LIMIT) {
+        planCache.erase(planCacheOrder.back().first);
+        planCacheOrder.pop_back();
+    }
+    planCacheOrder.emplace_front(query, plan);
+    planCache.emplace(planCacheOrder.front().first, planCacheOrder.begin());
+    return plan;
 }
 
-void HealthcareManagementSystem::searchDoctorByID(string doctorID) {
-    int pos = binarySearch(doctorPrimaryIndex, doctorID);
-    if (pos == -1) {
-        cout << "Doctor not found.\n";
+// parameter is the value for a '?' placeholder and is ignored when the plan has none.
+void HealthcareManagementSystem::executeQuery(const PreparedQuery& plan, string_view parameter) {
+    ScopedTimer timer(OP_PROCESS_QUERY);
+    string_view value = plan.hasParameter ? parameter : string_view(plan.value);
+    if (value.empty()) {
+        cout << "Empty field value.\n";
         return;
     }
-    string record = readRecordFromFile(DOCTOR_FILE, doctorPrimaryIndex[pos].second);
-    size_t d1 = record.find('|');
-    string id = record.substr(4, d1 - 4);
-    size_t d2 = record.find('|', d1 + 1);
-    string name = record.substr(d1 + 1, d2 - d1 - 1);
-    string address = record.substr(d2 + 1);
-    cout << "\n--- Doctor Details ---\n";
-    cout << "Doctor ID: " << id << "\n";
-    cout << "Name: " << name << "\n";
-    cout << "Address: " << address << "\n";
-    cout << "-----------------------\n";
+    switch (plan.action) {
+        case QUERY_DOCTOR_BY_ID:
+            searchDoctorByID(value);
+            break;
+        case QUERY_DOCTOR_NAME_BY_ID:
+            searchNameForQuary(value);
+            break;
+        case QUERY_APPOINTMENT_BY_ID:
+            searchAppointmentsByID(value);
+            break;
+        case QUERY_APPOINTMENTS_BY_DOCTOR:
+            searchAppointmentsByDoctorID(value);
+            break;
+        case QUERY_COUNT_APPOINTMENTS_BY_DOCTOR:
+            countAppointments(value);
+            break;
+        case QUERY_SCAN:
+            scanTable(plan, value);
+            break;
+        case QUERY_JOIN_BY_APPOINTMENT:
+        case QUERY_JOIN_BY_DOCTOR:
+        case QUERY_JOIN_BY_DOCTOR_NAME:
+        case QUERY_JOIN_SCAN:
+            joinAppointments(plan, value);
+            break;
+    }
 }
-void HealthcareManagementSystem::searchDoctorByName() {
-    string name;
-    cout << "Enter Doctor Name to search: ";
-    cin.ignore();
-    getline(cin, name);
 
-    DoctorNode* doctorIDs = doctorSecondaryIndex.Index[name].head;
-    if (!doctorIDs) {
-        cout << "No doctors found with the name: " << name << endl;
+// Answers filters on fields without an index. The text file is streamed in chunks
+// against a pinned snapshot, without the writer lock, and each chunk is scanned on
+// all cores; compressed and archived appointments are filtered after it, so results
+// come in storage order.
+void HealthcareManagementSystem::scanTable(const PreparedQuery& plan, string_view value) {
+    ScanPredicate predicate{plan.field, plan.contains, value};
+    auto snap = snapshot();
+    size_t count = 0;
+    vector<string> matches;
+    auto take = [&](string_view record) {
+        count++;
+        if (plan.column != COLUMN_COUNT)
+            matches.emplace_back(record);
+    };
+    scanTextFile(*snap, plan.doctors, predicate, take);
+    if (!plan.doctors) {
+        for (const string& record : coldAppointmentRecords(*snap)) {
+            if (predicate.matches(record))
+                take(record);
+        }
+    }
+    if (plan.column == COLUMN_COUNT) {
+        cout << count << "\n";
         return;
     }
-
-    while (doctorIDs) {
-        int pos = binarySearch(doctorPrimaryIndex, doctorIDs->doctorID);
-        if (pos != -1) {
-            string record = readRecordFromFile(DOCTOR_FILE, doctorPrimaryIndex[pos].second);
-
-            string doctorID = extractField(record.substr(4,record.length()), 0);
-            string doctorName = extractField(record, 1);
-            string doctorAddress = extractField(record, 2);
-
-            cout << "\n--- Doctor Details ---\n";
-            cout << "Doctor ID: " << doctorID << "\n";
-            cout << "Name: " << doctorName << "\n";
-            cout << "Address: " << doctorAddress << "\n";
-            cout << "-----------------------\n";
+    if (matches.empty()) {
+        cout << "No matching records found.\n";
+        return;
+    }
+    for (const string& record : matches) {
+        if (!plan.doctors) {
+            displayAppointmentRecord(AppointmentRecord::parse(record));
+            continue;
         }
-        doctorIDs = doctorIDs->next;
+        DoctorRecord doctor = DoctorRecord::parse(record);
+        if (plan.column == COLUMN_DOCTOR_NAME)
+            cout << doctor.get<DoctorSchema::NAME>() << "\n";
+        else
+            displayDoctorRecord(doctor);
     }
 }
 
-void HealthcareManagementSystem::loadAvailList(vector<int>& availList, const string& fileName) {
-    ifstream file(fileName, ios::in);
-    if (!file) {
-        cerr << "Error: Unable to open " << fileName << " for reading." << endl;
-        return;
+// Joins appointments with their doctors on the doctor ID, leaving out appointments
+// whose doctor no longer exists. An equality filter on an indexed key runs as an index
+// nested loop: the matching appointments come from the indexes and each doctor is
+// read once through a per-query cache. Other filters, and keys matching more than
+// JOIN_NESTED_LOOP_LIMIT appointments, run as a hash join: the live doctors are hashed
+// by ID from one streamed scan of the doctor file and the appointment scan probes that
+// table as it streams, so a joined listing costs about as much as the appointment scan
+// alone. Both scans run against one pinned snapshot, without the writer lock.
+void HealthcareManagementSystem::joinAppointments(const PreparedQuery& plan, string_view value) {
+    size_t rows = 0;
+    auto emit = [&](const AppointmentRecord& appointment, const DoctorRecord& doctor) {
+        rows++;
+        if (plan.column == COLUMN_DOCTOR_NAME)
+            cout << doctor.get<DoctorSchema::NAME>() << "\n";
+        else if (plan.column == COLUMN_ALL)
+            displayJoinedRecord(appointment, doctor);
+    };
+    auto finish = [&]() {
+        if (plan.column == COLUMN_COUNT)
+            cout << rows << "\n";
+        else if (rows == 0)
+            cout << "No matching records found.\n";
+    };
+
+    auto snap = snapshot();
+    vector<pair<string, string>> records;  // (appointment ID, stored record)
+    bool nestedLoop = plan.action != QUERY_JOIN_SCAN;
+    if (plan.action == QUERY_JOIN_BY_APPOINTMENT) {
+        const int* position = findInIndex(*snap->appointmentPrimary, *snap->appointmentFilter, BLOOM_APPOINTMENT, value);
+        string record = position ? readAppointmentRecord(*snap, *position) : findArchivedRecord(value);
+        if (!record.empty())
+            records.push_back({string(value), record});
+    } else if (nestedLoop) {
+        vector<string> doctorIDs;
+        if (plan.action == QUERY_JOIN_BY_DOCTOR) {
+            doctorIDs.emplace_back(value);
+        } else {
+            if (const PostingList* ids = findPostings(*snap->doctorsByName, *snap->doctorNameFilter, BLOOM_DOCTOR_NAME, value)) {
+                for (StringHandle id : **ids)
+                    doctorIDs.emplace_back(stringPool.str(id));
+            }
+        }
+        vector<StringHandle> hot;
+        vector<string> archived;
+        for (const string& doctorID : doctorIDs) {
+            if (const PostingList* ids = snap->appointmentsByDoctor->find(stringPool.find(doctorID)))
+                hot.insert(hot.end(), (*ids)->begin(), (*ids)->end());
+            shared_lock<shared_mutex> storageLock(storageMutex);
+            vector<string> ids = appointmentArchive.findByDoctor(doctorID);
+            archived.insert(archived.end(), ids.begin(), ids.end());
+        }
+        nestedLoop = hot.size() + archived.size() <= JOIN_NESTED_LOOP_LIMIT;
+        if (nestedLoop) {
+            for (const string& appointmentID : archived) {
+                string record = findArchivedRecord(appointmentID);
+                if (!record.empty())
+                    records.push_back({appointmentID, record});
+            }
+            for (StringHandle appointmentID : hot) {
+                if (const int* pos = snap->appointmentPrimary->find(appointmentID))
+                    records.push_back({string(stringPool.str(appointmentID)), readAppointmentRecord(*snap, *pos)});
+            }
+        }
     }
-    int pos;
-    while (file >> pos) {
-        availList.push_back(pos);
+    if (nestedLoop) {
+        unordered_map<string, DoctorRecord> doctorCache;
+        for (const auto& entry : records) {
+            AppointmentRecord appointment = AppointmentRecord::fromStored(entry.second);
+            appointment.get<AppointmentSchema::ID>() = entry.first;
+            const DoctorRecord& doctor = cachedDoctor(*snap, doctorCache, appointment.get<AppointmentSchema::DOCTOR_ID>());
+            if (!doctor.key().empty())
+                emit(appointment, doctor);
+        }
+        finish();
+        return;
     }
-    file.close();
-}
 
-void HealthcareManagementSystem::saveAvailList(const vector<int>& availList, const string& fileName) {
-    ofstream file(fileName, ios::out | ios::trunc);
-    if (!file) {
-        cerr << "Error: Unable to open " << fileName << " for writing." << endl;
+    // Hash join. The filter applies to the doctors being hashed or to the appointments
+    // probing them; the other side is taken whole.
+    ScanPredicate everything{0, true, ""};
+    ScanPredicate filter{plan.field, plan.contains, value};
+    unordered_map<string, DoctorRecord> doctorsByID;
+    scanTextFile(*snap, true, plan.doctors ? filter : everything, [&](string_view record) {
+        DoctorRecord doctor = DoctorRecord::parse(record);
+        string doctorID = doctor.key();
+        doctorsByID.emplace(move(doctorID), move(doctor));
+    });
+    if (doctorsByID.empty()) {
+        finish();
         return;
     }
-    for (int pos : availList) {
-        file << pos << "\n";
+    const ScanPredicate& appointmentFilter = plan.doctors ? everything : filter;
+    auto probe = [&](string_view record) {
+        auto it = doctorsByID.find(string(record.substr(record.rfind('|') + 1)));
+        if (it == doctorsByID.end())
+            return;
+        if (plan.column == COLUMN_COUNT)
+            rows++;
+        else
+            emit(AppointmentRecord::parse(record), it->second);
+    };
+    scanTextFile(*snap, false, appointmentFilter, probe);
+    for (const string& record : coldAppointmentRecords(*snap)) {
+        if (appointmentFilter.matches(record))
+            probe(record);
     }
-    file.close();
+    finish();
 }
 
-void HealthcareManagementSystem::deleteAppointment() {
-    string appointmentID;
-    cout << "Enter Appointment ID to delete: ";
-    cin >> appointmentID;
-    int pos = binarySearch(appointmentPrimaryIndex, appointmentID);
-    if (pos == -1) {
-        cout << "Appointment not found.\n";
-        return;
+// Doctors read by one query, keyed by ID. A missing doctor is cached as an empty
+// record, so it is looked up only once as well.
+const DoctorRecord& HealthcareManagementSystem::cachedDoctor(const IndexSnapshot& snap, unordered_map<string, DoctorRecord>& cache, const string& doctorID) {
+    auto it = cache.find(doctorID);
+    if (it != cache.end())
+        return it->second;
+    DoctorRecord doctor;
+    const int* position = findInIndex(*snap.doctorPrimary, *snap.doctorFilter, BLOOM_DOCTOR, doctorID);
+    if (position) {
+        doctor = DoctorRecord::fromStored(doctorTable.readLine(*position));
+        doctor.get<DoctorSchema::ID>() = doctorID;
     }
-    string appointmentIDToDelete = appointmentPrimaryIndex[pos].first;
-    int recordPosition = appointmentPrimaryIndex[pos].second;
-    string record = readRecordFromFile(APPOINTMENT_FILE, recordPosition);
-    size_t d1 = record.find('|');
-    size_t d2 = record.find('|', d1 + 1);
-    string doctorID = record.substr(d2 + 1);
-    markDeleted(appointmentAvailList, recordPosition, APPOINTMENT_FILE);
-    appointmentPrimaryIndex.erase(appointmentPrimaryIndex.begin() + pos);
-    saveIndexes();
-    appointmentSecondaryIndex.remove(doctorID, appointmentIDToDelete);
-    appointmentSecondaryIndex.save();
-    cout << "Appointment deleted successfully.\n";
+    return cache.emplace(doctorID, doctor).first->second;
 }
 
+void HealthcareManagementSystem::displayJoinedRecord(const AppointmentRecord& appointment, const DoctorRecord& doctor) {
+    cout << "\n--- Appointment Details ---\n";
+    cout << "Appointment ID: " << appointment.get<AppointmentSchema::ID>() << "\n";
+    cout << "Date: " << appointment.get<AppointmentSchema::DATE>() << "\n";
+    cout << "Doctor ID: " << appointment.get<AppointmentSchema::DOCTOR_ID>() << "\n";
+    cout << "Doctor Name: " << doctor.get<DoctorSchema::NAME>() << "\n";
+    cout << "Doctor Address: " << doctor.get<DoctorSchema::ADDRESS>() << "\n";
+    cout << "---------------------------\n";
+}
 
-
-void HealthcareManagementSystem::addAppointment(const string& appointmentID, const string& doctorID, const string& date) {
-    if (appointmentID.length() > 15 || doctorID.length() > 15 || date.length() > 30) {
-        cout << "Error: Input exceeds the maximum allowed length.\n";
+void HealthcareManagementSystem::processQuery(const string& query) {
+    shared_ptr<const PreparedQuery> plan = prepareQuery(query);
+    string retry;
+    while (!plan && cin) {
+        cout << "Invalid query. Please try again.\n";
+        cout << "Enter your query: ";
+        getline(cin, retry);
+        plan = prepareQuery(retry);
+    }
+    if (!plan)
         return;
+    string parameter;
+    if (plan->hasParameter) {
+        cout << "Enter value for ?: ";
+        getline(cin, parameter);
     }
-    if (binarySearch(doctorPrimaryIndex, doctorID) == -1) {
-        cout << "Error: Doctor ID does not exist. Please add the doctor before adding an appointment.\n";
+    TraceScope trace("query", {retry.empty() ? query : retry, parameter});
+    executeQuery(*plan, parameter);
+}
+// Moves appointments dated before the cutoff into the block-compressed store.
+// Records already compressed are carried over, so this also compacts the store.
+void HealthcareManagementSystem::compressAppointments(const string& cutoffDate) {
+    if (rejectOnReplica())
+        return;
+    lock_guard<mutex> lock(writerMutex);
+    TraceScope trace("compress", {cutoffDate});
+    ParsedDate cutoff;
+    if (!parseDate(cutoffDate, cutoff)) {
+        cout << "Error: Invalid date. Use YYYY-MM-DD.\n";
         return;
     }
-    if (binarySearch(appointmentPrimaryIndex, appointmentID) != -1) {
-        cout << "Appointment with this ID already exists.\n";
+    vector<string> coldRecords;
+    vector<StringHandle> coldKeys;
+    vector<int> textPositions;
+    size_t liveBlockRefs = 0;
+    for (const auto& entry : appointmentTable.positions()) {
+        int position = entry.second;
+        liveBlockRefs += AppointmentBlockStore::isBlockRef(position);
+        string record = readAppointmentRecord(position);
+        if (record.length() < 4)
+            continue;
+        record = record.substr(4);
+        ParsedDate date;
+        string dateText = AppointmentRecord::parse(record).get<AppointmentSchema::DATE>();
+        bool cold = AppointmentBlockStore::isBlockRef(position) ||
+                    (parseDate(dateText, date) && date.days < cutoff.days);
+        if (!cold)
+            continue;
+        coldRecords.push_back(record);
+        coldKeys.push_back(entry.first);
+        if (!AppointmentBlockStore::isBlockRef(position))
+            textPositions.push_back(position);
+    }
+    // Deletes and updates leave their old copies in the blocks; a run that has no new
+    // cold records still rewrites the store to drop them.
+    size_t staleCopies = appointmentBlockStore->recordCount() - min(liveBlockRefs, appointmentBlockStore->recordCount());
+    if (textPositions.empty() && staleCopies == 0) {
+        cout << "No appointments to compress.\n";
         return;
     }
-    int position = findAvailableSlot(appointmentAvailList, APPOINTMENT_FILE);
-    if (position == -1) {
-        fstream appointmentFile(APPOINTMENT_FILE, ios::in | ios::out);
-        appointmentFile.seekp(0, ios::end);
-        position = appointmentFile.tellp();
-        appointmentFile.close();
-    }
-    string fullRecord = appointmentID + "|" + date + "|" + doctorID;
-    fstream appointmentFile(APPOINTMENT_FILE, ios::in | ios::out);
-    appointmentFile.seekp(position, ios::beg);
-    appointmentFile << setw(4) << setfill('0') << fullRecord.length() << fullRecord << "\n";
-    appointmentFile.close();
-    auto it = lower_bound(appointmentPrimaryIndex.begin(), appointmentPrimaryIndex.end(), make_pair(appointmentID, 0));
-    appointmentPrimaryIndex.insert(it, {appointmentID, position});
-    appointmentSecondaryIndex.insert(doctorID, appointmentID);
-    appointmentSecondaryIndex.save();
+    // The new generation goes to its own file; the current one stays valid for the
+    // saved index until saveIndexes names the new one, and for readers until the
+    // snapshots that use it are released.
+    auto blocks = make_shared<AppointmentBlockStore>(blockFileName(appointmentBlockGeneration + 1));
+    vector<int> refs = blocks->rewrite(coldRecords);
+    if (refs.size() != coldRecords.size()) {
+        cout << "Error: Compression failed, appointments left unchanged.\n";
+        remove(blocks->BLOCK_FILE.c_str());
+        return;
+    }
+    for (size_t i = 0; i < coldKeys.size(); i++)
+        appointmentTable.setPosition(stringPool.str(coldKeys[i]), refs[i]);
+    appointmentBlockStore = blocks;
+    appointmentBlockGeneration++;
+    appointmentTable.setTag(APPOINTMENT_BLOCKS_TAG, to_string(appointmentBlockGeneration));
+    appointmentTable.release(textPositions);
     saveIndexes();
-    cout << "Appointment added successfully.\n";
+    publishSnapshot(SNAPSHOT_APPOINTMENTS);
+    logChange({"compress", cutoffDate});
+    cout << "Compressed " << textPositions.size() << " appointments into "
+         << appointmentBlockStore->blockCount() << " blocks";
+    if (staleCopies)
+        cout << ", dropping " << staleCopies << " stale copies";
+    cout << ".\n";
 }
 
-void HealthcareManagementSystem::updateAppointment() {
-    string appointmentID, newDate, newDoctorID;
-    cout << "Enter Appointment ID to update: ";
-    cin >> appointmentID;
-
-    if (appointmentID.length() > 15 ) {
-        cout << "Error: Input exceeds the maximum allowed length.\n";
+// Moves appointments dated before the cutoff out of the hot indexes and into the
+// read-only archive, which lookups fall through to when the hot index misses.
+void HealthcareManagementSystem::archiveAppointments(const string& cutoffDate) {
+    if (rejectOnReplica())
         return;
-    }
-    int pos = binarySearch(appointmentPrimaryIndex, appointmentID);
-    if (pos == -1) {
-        cout << "Appointment not found.\n";
+    lock_guard<mutex> lock(writerMutex);
+    TraceScope trace("archive", {cutoffDate});
+    ParsedDate cutoff;
+    if (!parseDate(cutoffDate, cutoff)) {
+        cout << "Error: Invalid date. Use YYYY-MM-DD.\n";
         return;
     }
-    string record = readRecordFromFile(APPOINTMENT_FILE, appointmentPrimaryIndex[pos].second);
-    size_t delim1 = record.find('|');
-    size_t delim2 = record.find('|', delim1 + 1);
-    string id = record.substr(0, delim1);
-    string date = record.substr(delim1 + 1, delim2 - delim1 - 1);
-    string doctorID = record.substr(delim2 + 1);
-    cout << "Enter new appointment date (leave blank to skip): ";
-    cin.ignore();
-    getline(cin, newDate);
-    if (!newDate.empty()) {
-        date = newDate;
+    vector<string> archivedRecords;
+    vector<pair<string, string>> archivedKeys;  // (appointmentID, doctorID)
+    vector<int> textPositions;
+    vector<pair<StringHandle, int>> hotIndex;
+    for (const auto& entry : appointmentTable.positions()) {
+        string record = readAppointmentRecord(entry.second);
+        AppointmentRecord appointment = AppointmentRecord::fromStored(record);
+        ParsedDate date;
+        if (record.length() < 4 || !parseDate(appointment.get<AppointmentSchema::DATE>(), date) || date.days >= cutoff.days) {
+            hotIndex.push_back(entry);
+            continue;
+        }
+        appointment.get<AppointmentSchema::ID>() = stringPool.str(entry.first);
+        archivedRecords.push_back(appointment.serialize());
+        archivedKeys.push_back({string(stringPool.str(entry.first)), appointment.get<AppointmentSchema::DOCTOR_ID>()});
+        if (!AppointmentBlockStore::isBlockRef(entry.second))
+            textPositions.push_back(entry.second);
     }
-    cout << "Enter new doctor ID (leave blank to skip): ";
-    getline(cin, newDoctorID);
-    if (!newDoctorID.empty() && newDoctorID != doctorID) {
-        appointmentSecondaryIndex.Index[doctorID].remove(appointmentID);
-        if (appointmentSecondaryIndex.Index[doctorID].head == nullptr)
-            appointmentSecondaryIndex.Index.erase(doctorID);
-        appointmentSecondaryIndex.insert(newDoctorID, appointmentID);
-        doctorID = newDoctorID;
+    if (archivedRecords.empty()) {
+        cout << "No appointments to archive.\n";
+        return;
     }
-
-    string updatedRecord = id + "|" + date + "|" + doctorID;
-    fstream file(APPOINTMENT_FILE, ios::in | ios::out);
-    if (!file) {
-        cerr << "Error: Unable to open " << APPOINTMENT_FILE << "\n";
+    unique_lock<shared_mutex> storageLock(storageMutex);
+    if (!appointmentArchive.append(archivedRecords, cutoffDate)) {
+        cout << "Error: Archiving failed, appointments left unchanged.\n";
         return;
     }
-    file.seekp(appointmentPrimaryIndex[pos].second, ios::beg);
-    file << setw(4) << setfill('0') << updatedRecord.length() << updatedRecord << "\n";
-    file.close();
-
-    appointmentSecondaryIndex.save();
+    storageLock.unlock();
+    appointmentTable.setPositions(move(hotIndex));
+    for (const auto& key : archivedKeys)
+        appointmentSecondaryIndex().remove(key.second, key.first);
+    {
+        lock_guard<mutex> availabilityLock(availabilityMutex);
+        for (const string& archivedRecord : archivedRecords) {
+            AppointmentRecord appointment = AppointmentRecord::parse(archivedRecord);
+            int day, slot;
+            if (appointmentSlot(appointment.get<AppointmentSchema::DATE>(), day, slot))
+                availability.release(appointment.get<AppointmentSchema::DOCTOR_ID>(), day, slot);
+        }
+    }
+    appointmentTable.release(textPositions);
     saveIndexes();
-    cout << "Appointment updated successfully.\n";
+    publishSnapshot(SNAPSHOT_APPOINTMENTS);
+    logChange({"archive", cutoffDate});
+    cout << "Archived " << archivedRecords.size() << " appointments (" << appointmentArchive.size()
+         << " in archive, " << appointmentTable.positions().size() << " still active).\n";
 }
 
-void HealthcareManagementSystem::searchAppointmentsByID(string arg = ""s) {
-    string appointmentID;
-    if (arg.empty()) {
-        cout << "Enter Appointment ID to search: ";
-        cin >> appointmentID;
-    } else {
-        appointmentID = arg;
+void HealthcareManagementSystem::findNextFreeSlot(const string& doctorID, const string& after) {
+    TraceScope trace("next_free_slot", {doctorID, after});
+    ParsedDate start;
+    if (!parseDate(after, start)) {
+        cout << "Error: Invalid date. Use YYYY-MM-DD HH:MM.\n";
+        return;
     }
-    int pos = binarySearch(appointmentPrimaryIndex, appointmentID);
-    if (pos == -1) {
-        cout << "Appointment not found.\n";
+    auto snap = snapshot();
+    if (!findInIndex(*snap->doctorPrimary, *snap->doctorFilter, BLOOM_DOCTOR, doctorID)) {
+        cout << "Doctor not found.\n";
         return;
     }
-    string record = readRecordFromFile(APPOINTMENT_FILE, appointmentPrimaryIndex[pos].second);
-    if (record.empty()) {
-        cout << "Error: Unable to retrieve appointment record.\n";
+    // Round a partial slot up so the answer never starts before the requested time.
+    int minute = max(start.minuteOfDay, 0);
+    int slot = (minute + AvailabilityIndex::SLOT_MINUTES - 1) / AvailabilityIndex::SLOT_MINUTES;
+    int freeDay, freeSlot;
+    bool found;
+    {
+        lock_guard<mutex> availabilityLock(availabilityMutex);
+        found = availability.nextFreeSlot(doctorID, start.days, slot, freeDay, freeSlot);
+    }
+    if (!found) {
+        cout << "No free slot found for Doctor ID " << doctorID << " in the next year.\n";
         return;
     }
-    size_t delim1 = record.find('|');
-    size_t delim2 = record.find('|', delim1 + 1);
-    string id = record.substr(0, delim1);
-    string date = record.substr(delim1 + 1, delim2 - delim1 - 1);
-    string docID = record.substr(delim2 + 1);
-    cout << "\n--- Appointment Details ---\n";
-    cout << "Appointment ID: " << id << "\n";
-    cout << "Date: " << date << "\n";
-    cout << "Doctor ID: " << docID << "\n";
-    cout << "---------------------------\n";
+    ParsedDate free;
+    free.days = freeDay;
+    free.minuteOfDay = freeSlot * AvailabilityIndex::SLOT_MINUTES;
+    free.padMonth = free.padDay = true;
+    cout << "First free slot for Doctor ID " << doctorID << ": " << formatDate(free) << "\n";
 }
-void HealthcareManagementSystem::searchAppointmentsByDoctorID(string arg = ""s) {
-    string doctorID = arg;
-    if (doctorID.empty()) {
-        cout << "Enter Doctor ID to search: ";
-        cin >> doctorID;
+
+void HealthcareManagementSystem::findFreeDoctors(const string& at) {
+    TraceScope trace("free_doctors", {at});
+    int day, slot;
+    if (!appointmentSlot(at, day, slot)) {
+        cout << "Error: Invalid time. Use YYYY-MM-DD HH:MM.\n";
+        return;
     }
-    auto it = appointmentSecondaryIndex.Index.find(doctorID);
-    if (it == appointmentSecondaryIndex.Index.end() || it->second.head == nullptr) {
-        cout << "No appointments found for Doctor ID: " << doctorID << endl;
+    if (slot < AvailabilityIndex::FIRST_BOOKABLE_SLOT || slot >= AvailabilityIndex::LAST_BOOKABLE_SLOT) {
+        cout << "That time is outside bookable hours (08:00-18:00).\n";
         return;
     }
-    cout << "\nAppointments for Doctor ID: " << doctorID << "\n";
-    AppointmentNode* current = it->second.head;
-    while (current) {
-        int pos = binarySearch(appointmentPrimaryIndex, current->appointmentID);
-        if (pos != -1) {
-            string record = readRecordFromFile(APPOINTMENT_FILE, appointmentPrimaryIndex[pos].second);
-            if (!record.empty()) {
-                string appointmentID = extractField(record, 0);
-                string date = extractField(record, 1);
-                string docID = extractField(record, 2);
-
-                cout << "\n--- Appointment Details ---\n";
-                cout << "Appointment ID: " << appointmentID << "\n";
-                cout << "Date: " << date << "\n";
-                cout << "Doctor ID: " << docID << "\n";
-                cout << "---------------------------\n";
-            } else {
-                cout << "Error: Unable to read record for Appointment ID: " << current->appointmentID << "\n";
+    vector<string> doctors;
+    {
+        lock_guard<mutex> availabilityLock(availabilityMutex);
+        doctors = availability.freeDoctors(day, slot);
+    }
+    if (doctors.empty()) {
+        cout << "No doctors are free at " << at << ".\n";
+        return;
+    }
+    cout << "Doctors free at " << at << ":";
+    for (const string& doctorID : doctors)
+        cout << " " << doctorID;
+    cout << "\n";
+}
+
+void HealthcareManagementSystem::countAppointments(string_view doctorID) {
+    lock_guard<mutex> countersLock(countersMutex);
+    cout << appointmentCounters.countForDoctor(doctorID) << "\n";
+}
+
+// COUNT / GROUP BY style questions answered from the materialized counters.
+void HealthcareManagementSystem::showLoadReport() {
+    int option;
+    cout << "\n--- Appointment Load Report ---\n";
+    cout << "1. Appointments per doctor in a date range\n";
+    cout << "2. Busiest days in a date range\n";
+    cout << "3. Doctors over capacity on a day\n";
+    cout << "4. Monthly appointments for a doctor\n";
+    cout << "Enter your choice: ";
+    cin >> option;
+    auto readDay = [](const string& prompt, int& day) {
+        string text;
+        cout << prompt;
+        cin >> text;
+        ParsedDate date;
+        if (!parseDate(text, date)) {
+            cout << "Error: Invalid date. Use YYYY-MM-DD.\n";
+            return false;
+        }
+        day = date.days;
+        return true;
+    };
+    auto dayText = [](int day) {
+        ParsedDate date;
+        date.days = day;
+        date.padMonth = date.padDay = true;
+        return formatDate(date);
+    };
+    int fromDay, toDay;
+    lock_guard<mutex> countersLock(countersMutex);
+    switch (option) {
+        case 1: {
+            if (!readDay("From (YYYY-MM-DD): ", fromDay) || !readDay("To (YYYY-MM-DD): ", toDay))
+                return;
+            map<string, int> counts = appointmentCounters.countByDoctor(fromDay, toDay);
+            if (counts.empty())
+                cout << "No appointments in that range.\n";
+            for (const auto& entry : counts)
+                cout << "Doctor ID " << entry.first << ": " << entry.second << "\n";
+            break;
+        }
+        case 2: {
+            if (!readDay("From (YYYY-MM-DD): ", fromDay) || !readDay("To (YYYY-MM-DD): ", toDay))
+                return;
+            vector<pair<int, int>> days = appointmentCounters.busiestDays(fromDay, toDay, 10);
+            if (days.empty())
+                cout << "No appointments in that range.\n";
+            for (const auto& entry : days)
+                cout << dayText(entry.first) << ": " << entry.second << "\n";
+            break;
+        }
+        case 3: {
+            int capacity;
+            if (!readDay("Day (YYYY-MM-DD): ", fromDay))
+                return;
+            cout << "Capacity (appointments per doctor per day): ";
+            cin >> capacity;
+            vector<pair<string, int>> doctors = appointmentCounters.overCapacity(fromDay, capacity);
+            if (doctors.empty())
+                cout << "No doctor is over capacity on that day.\n";
+            for (const auto& entry : doctors)
+                cout << "Doctor ID " << entry.first << ": " << entry.second << "\n";
+            break;
+        }
+        case 4: {
+            string doctorID;
+            cout << "Enter Doctor ID: ";
+            cin >> doctorID;
+            map<int, int> months = appointmentCounters.monthlyCounts(doctorID);
+            if (months.empty())
+                cout << "No appointments found for Doctor ID: " << doctorID << "\n";
+            for (const auto& entry : months) {
+                if (entry.first == 0)
+                    cout << "undated: " << entry.second << "\n";
+                else
+                    cout << entry.first / 100 << "-" << setw(2) << setfill('0') << entry.first % 100 << setfill(' ') << ": " << entry.second << "\n";
             }
-        } else {
-            cout << "Warning: Appointment ID " << current->appointmentID << " not found in primary index.\n";
+            break;
         }
-        current = current->next;
+        default:
+            cout << "Invalid choice.\n";
     }
 }
 
+// Copies the data files and compressed stores into memory under the writer lock, then
+// parses the copy on all cores so the export never holds up the live system.
+void HealthcareManagementSystem::exportColumnarSnapshot() {
+    TraceScope trace("export_snapshot", {});
+    ScopedTimer timer(OP_EXPORT_SNAPSHOT);
+    shared_ptr<const IndexSnapshot> snap;
+    string doctorText, appointmentText;
+    unordered_map<int, string> compressed;
+    vector<pair<int, string>> archived;
+    {
+        lock_guard<mutex> lock(writerMutex);
+        snap = snapshot();
+        doctorText = readWholeFile(doctorTable.DATA_FILE, OP_EXPORT_SNAPSHOT);
+        appointmentText = readWholeFile(appointmentTable.DATA_FILE, OP_EXPORT_SNAPSHOT);
+        shared_lock<shared_mutex> storageLock(storageMutex);
+        for (auto& entry : snap->appointmentBlocks->readAll())
+            compressed.emplace(entry.first, move(entry.second));
+        archived = appointmentArchive.store.readAll();
+    }
+
+    // Text records are "NNNN" + id|field|field; a trailing '*' marks a deleted record.
+    auto textRecord = [](const string& text, int position, string_view& record) {
+        if (position < 0 || (size_t)position >= text.size())
+            return false;
+        size_t end = text.find('\n', position);
+        record = string_view(text).substr(position, (end == string::npos ? text.size() : end) - position);
+        if (!record.empty() && record.back() == '\r')
+            record.remove_suffix(1);
+        return record.size() > 4 && record.back() != '*';
+    };
+    // Field 0 is taken from the index key, so only the fields after the first '|' are used.
+    auto fields = [](string_view record, string_view& first, string_view& second) {
+        size_t d1 = record.find('|');
+        if (d1 == string_view::npos)
+            return false;
+        size_t d2 = record.find('|', d1 + 1);
+        first = record.substr(d1 + 1, d2 == string_view::npos ? string_view::npos : d2 - d1 - 1);
+        second = d2 == string_view::npos ? string_view() : record.substr(d2 + 1);
+        return true;
+    };
+    auto setDate = [](string_view text, ColumnarSnapshot::AppointmentRow& row) {
+        ParsedDate date;
+        bool parsed = parseDate(string(text), date);
+        row.day = parsed ? date.days : INT32_MIN;
+        row.minute = parsed ? date.minuteOfDay : -1;
+    };
 
-string HealthcareManagementSystem::extractField(const string& record, int fieldIndex) {
-    size_t start = 0, end = 0;
-    int currentIndex = 0;
-    while ((end = record.find('|', start)) != string::npos) {
-        if (currentIndex == fieldIndex) {
-            return record.substr(start, end - start);
-        }
-        start = end + 1;
-        currentIndex++;
+    ColumnarSnapshot columns;
+    // The chunked indexes are flattened for random access by the scan.
+    vector<PrimaryIndex::Entry> doctorIndex(snap->doctorPrimary->begin(), snap->doctorPrimary->end());
+    columns.doctors = parallelScan<ColumnarSnapshot::DoctorRow>(doctorIndex.size(),
+        [&](size_t i, ColumnarSnapshot::DoctorRow& row) {
+            string_view record;
+            row.id = stringPool.str(doctorIndex[i].first);
+            return textRecord(doctorText, doctorIndex[i].second, record) && fields(record, row.name, row.address);
+        });
+    vector<PrimaryIndex::Entry> appointmentIndex(snap->appointmentPrimary->begin(), snap->appointmentPrimary->end());
+    columns.appointments = parallelScan<ColumnarSnapshot::AppointmentRow>(appointmentIndex.size() + archived.size(),
+        [&](size_t i, ColumnarSnapshot::AppointmentRow& row) {
+            string_view record, date;
+            if (i < appointmentIndex.size()) {
+                int position = appointmentIndex[i].second;
+                row.id = stringPool.str(appointmentIndex[i].first);
+                if (AppointmentBlockStore::isBlockRef(position)) {
+                    auto it = compressed.find(position);
+                    if (it == compressed.end())
+                        return false;
+                    record = it->second;
+                    row.tier = ColumnarSnapshot::TIER_COMPRESSED;
+                } else {
+                    if (!textRecord(appointmentText, position, record))
+                        return false;
+                    row.tier = ColumnarSnapshot::TIER_TEXT;
+                }
+            } else {
+                record = archived[i - appointmentIndex.size()].second;
+                row.id = record.substr(0, record.find('|'));
+                row.tier = ColumnarSnapshot::TIER_ARCHIVED;
+            }
+            if (!fields(record, date, row.doctorID))
+                return false;
+            setDate(date, row);
+            return true;
+        });
+
+    uint64_t bytes = columns.write(SNAPSHOT_EXPORT_FILE);
+    if (bytes == 0) {
+        cout << "Error: Export failed.\n";
+        return;
     }
-    if (currentIndex == fieldIndex)
-        return record.substr(start);
+    cout << "Exported " << columns.doctors.size() << " doctors and " << columns.appointments.size()
+         << " appointments to " << SNAPSHOT_EXPORT_FILE << " (" << bytes << " bytes).\n";
+}
 
-    return "";
+// Writers call this under writerMutex once a change is on disk. A replica re-logs the
+// entries it applies under the primary's sequence numbers, so it can be tailed in turn.
+void HealthcareManagementSystem::logChange(const vector<string>& entry) {
+    changeLog.append(replaySequence ? replaySequence : changeLog.lastSequence() + 1, entry);
 }
 
-void HealthcareManagementSystem::loadIndexes() {
-    fstream doctorIndexFile(DOCTOR_INDEX_FILE, ios::in);
-    if (doctorIndexFile.is_open()) {
-        string record;
-        while (getline(doctorIndexFile, record)) {
-            stringstream ss(record);
-            string doctorID;
-            int position;
-            getline(ss, doctorID, '|');
-            ss >> position;
-            doctorPrimaryIndex.push_back({doctorID, position});
+void HealthcareManagementSystem::applyChange(const vector<string>& entry) {
+    auto arg = [&entry](size_t i) { return i < entry.size() ? entry[i] : string(); };
+    const string& operation = entry[0];
+    if (operation == "add_doctor")
+        addDoctor(arg(1), arg(2), arg(3));
+    else if (operation == "update_doctor")
+        updateDoctorRecord(arg(1), arg(2), arg(3));
+    else if (operation == "delete_doctor")
+        deleteDoctorByID(arg(1));
+    else if (operation == "add_appointment")
+        addAppointment(arg(1), arg(2), arg(3));
+    else if (operation == "update_appointment")
+        updateAppointmentRecord(arg(1), arg(2), arg(3));
+    else if (operation == "delete_appointment")
+        deleteAppointmentByID(arg(1));
+    else if (operation == "compress")
+        compressAppointments(arg(1));
+    else if (operation == "archive")
+        archiveAppointments(arg(1));
+    else if (operation == "add_patient")
+        addPatient(arg(1), arg(2), arg(3), arg(4));
+    else if (operation == "update_patient")
+        updatePatient(arg(1), arg(2), arg(3), arg(4));
+    else if (operation == "delete_patient")
+        deletePatient(arg(1));
+    else if (operation == "link_appointment")
+        linkAppointmentToPatient(arg(1), arg(2));
+    else
+        cerr << "Warning: Unknown change '" << operation << "' skipped." << endl;
+}
+
+// Runs one entry of a workload trace. Writes go through applyChange; reads and queries
+// are dispatched here, since they never appear in the change log.
+void HealthcareManagementSystem::replayOperation(const vector<string>& entry) {
+    auto arg = [&entry](size_t i) { return i < entry.size() ? entry[i] : string(); };
+    const string& operation = entry[0];
+    if (operation == "search_doctor")
+        searchDoctorByID(arg(1));
+    else if (operation == "search_doctor_name")
+        searchDoctorByName(arg(1));
+    else if (operation == "search_appointment")
+        searchAppointmentsByID(arg(1));
+    else if (operation == "search_doctor_appointments")
+        searchAppointmentsByDoctorID(arg(1));
+    else if (operation == "search_patient")
+        searchPatientByID(arg(1));
+    else if (operation == "search_patient_name")
+        searchPatientsByName(arg(1));
+    else if (operation == "search_patient_appointments")
+        searchAppointmentsByPatientID(arg(1));
+    else if (operation == "next_free_slot")
+        findNextFreeSlot(arg(1), arg(2));
+    else if (operation == "free_doctors")
+        findFreeDoctors(arg(1));
+    else if (operation == "export_snapshot")
+        exportColumnarSnapshot();
+    else if (operation == "query") {
+        shared_ptr<const PreparedQuery> plan = prepareQuery(arg(1));
+        if (plan)
+            executeQuery(*plan, arg(2));
+    } else
+        applyChange(entry);
+}
+
+// Follows the change log of the primary in source (its directory or the log file
+// itself). This instance's data files, changes.log included, must start as a copy of
+// the primary's; the local log then records how far the replica has got.
+bool HealthcareManagementSystem::startReplica(const string& source) {
+    string logFile = filesystem::is_directory(source) ? (filesystem::path(source) / changeLog.LOG_FILE).string() : source;
+    if (filesystem::exists(logFile) && filesystem::exists(changeLog.LOG_FILE) &&
+        filesystem::equivalent(logFile, changeLog.LOG_FILE)) {
+        cerr << "Error: A replica needs its own copy of the data files." << endl;
+        return false;
+    }
+    replicaSource = logFile;
+    replicaOffset = 0;
+    replicaFromPipe = filesystem::is_fifo(logFile);
+    if (replicaFromPipe) {
+        thread(&HealthcareManagementSystem::followReplicaPipe, this).detach();
+        cout << "Replica of " << replicaSource << " (pipe) at change " << changeLog.lastSequence() << ".\n";
+        return true;
+    }
+    ifstream state(REPLICA_STATE_FILE, ios::in);
+    string line;
+    if (getline(state, line) && line.find('|') != string::npos) {
+        // Entries up to the local sequence are skipped by number, so a stale offset
+        // only costs a rescan.
+        replicaOffset = atoll(line.c_str() + line.find('|') + 1);
+    }
+    cout << "Replica of " << replicaSource << " at change " << changeLog.lastSequence() << ".\n";
+    catchUpReplica();
+    return true;
+}
+
+// Applies every complete entry the primary has logged since the last call. The menu
+// calls this before each command, so reads are never older than the log shipping delay.
+// A log file is reread from the saved offset; a pipe is read once, in order, by
+// followReplicaPipe.
+void HealthcareManagementSystem::catchUpReplica() {
+    streambuf* console = cout.rdbuf(nullptr);
+    TraceScope untraced(nullptr, {});  // the primary's trace already has these
+    uint64_t before = changeLog.lastSequence();
+    if (replicaFromPipe) {
+        deque<string> lines;
+        {
+            lock_guard<mutex> pipeLock(replicaPipeMutex);
+            lines.swap(replicaPipeLines);
+        }
+        while (!lines.empty() && applyReplicaLine(lines.front()))
+            lines.pop_front();
+        if (!lines.empty()) {
+            // Kept for the next call, ahead of anything queued since.
+            lock_guard<mutex> pipeLock(replicaPipeMutex);
+            replicaPipeLines.insert(replicaPipeLines.begin(), lines.begin(), lines.end());
+        }
+    } else {
+        ifstream file(replicaSource, ios::in | ios::binary);
+        if (file) {
+            file.seekg(0, ios::end);
+            if (file.tellg() < replicaOffset)
+                replicaOffset = 0;  // the log was replaced; skip by sequence number instead
+            file.seekg(replicaOffset, ios::beg);
+            string line;
+            while (getline(file, line)) {
+                if (file.eof())
+                    break;  // the primary is still writing this line
+                streamoff next = file.tellg();
+                if (!applyReplicaLine(line))
+                    break;
+                replicaOffset = next;
+            }
         }
-        doctorIndexFile.close();
     }
-    doctorSecondaryIndex.load();
-    sort(doctorPrimaryIndex.begin(), doctorPrimaryIndex.end());
+    uint64_t applied = changeLog.lastSequence() - before;
+    cout.rdbuf(console);
+    cout.clear();
+    saveReplicaState();
+    if (applied)
+        cout << "Applied " << applied << " changes from the primary (now at change " << changeLog.lastSequence() << ").\n";
+}
+
+// Applies one log line, skipping lines already applied or not parsable. Returns false
+// when the line is past a gap in the sequence and must wait.
+bool HealthcareManagementSystem::applyReplicaLine(string line) {
+    uint64_t seq;
+    vector<string> entry;
+    if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+    if (!ChangeLog::parse(line, seq, entry) || seq <= changeLog.lastSequence())
+        return true;
+    if (seq != changeLog.lastSequence() + 1) {
+        cerr << "Error: Replica is at change " << changeLog.lastSequence() << " but the primary's log continues at "
+             << seq << ". Copy the primary's data files again." << endl;
+        return false;
+    }
+    replaySequence = seq;
+    applyChange(entry);
+    // A change this copy rejected is still logged, so the sequence stays contiguous.
+    if (changeLog.lastSequence() < seq)
+        changeLog.append(seq, entry);
+    replaySequence = 0;
+    return true;
+}
 
-    fstream appointmentIndexFile(APPOINTMENT_INDEX_FILE, ios::in);
-    if (appointmentIndexFile.is_open()) {
+// Runs on its own thread for a pipe source. Opening blocks until a writer connects and
+// a read until it sends a line; when the writer closes, the pipe is opened again for
+// the next one. A line cut off by a closing writer is dropped.
+void HealthcareManagementSystem::followReplicaPipe() {
+    while (true) {
+        ifstream pipe(replicaSource, ios::in | ios::binary);
+        if (!pipe) {
+            this_thread::sleep_for(chrono::seconds(1));
+            continue;
+        }
         string line;
-        while (getline(appointmentIndexFile, line)) {
-            stringstream ss(line);
-            string appointmentID;
-            int position;
-            getline(ss, appointmentID, '|');
-            ss >> position;
-            appointmentPrimaryIndex.push_back({appointmentID, position});
+        while (getline(pipe, line) && !pipe.eof()) {
+            lock_guard<mutex> pipeLock(replicaPipeMutex);
+            replicaPipeLines.push_back(move(line));
         }
-        appointmentIndexFile.close();
     }
-    appointmentSecondaryIndex.load();
-    sort(appointmentPrimaryIndex.begin(), appointmentPrimaryIndex.end());
-    loadAvailList(doctorAvailList, "doctor.avail");
-    loadAvailList(appointmentAvailList, "appointment.avail");
 }
 
-void HealthcareManagementSystem::saveIndexes() {
-    fstream doctorIndexFile(DOCTOR_INDEX_FILE, ios::out);
-    if (!doctorIndexFile) {
-        cerr << "Error: Unable to open " << DOCTOR_INDEX_FILE << " for writing." << endl;
+// sequence|offset, the offset being where the next unread entry of the primary's log starts.
+void HealthcareManagementSystem::saveReplicaState() {
+    ofstream file(REPLICA_STATE_FILE, ios::out | ios::trunc);
+    file << changeLog.lastSequence() << "|" << replicaOffset << "\n";
+}
+
+void HealthcareManagementSystem::addPatient(const string& patientID, const string& name, const string& phone, const string& address) {
+    if (rejectOnReplica())
+        return;
+    lock_guard<mutex> lock(writerMutex);
+    TraceScope trace("add_patient", {patientID, name, phone, address});
+    if (const char* error = patients.insert(PatientRecord{{patientID, name, phone, address}})) {
+        cout << error << "\n";
         return;
     }
-    for (const auto& entry : doctorPrimaryIndex) {
-        doctorIndexFile << entry.first << "|" << entry.second << "\n";
-    }
-    doctorIndexFile.close();
+    patients.save();
+    logChange({"add_patient", patientID, name, phone, address});
+    cout << "Patient added successfully.\n";
+}
 
-    fstream appointmentIndexFile(APPOINTMENT_INDEX_FILE, ios::out);
-    if (!appointmentIndexFile) {
-        cerr << "Error: Unable to open " << APPOINTMENT_INDEX_FILE << " for writing." << endl;
+// Blank fields keep their current value.
+void HealthcareManagementSystem::updatePatient(const string& patientID, const string& newName, const string& newPhone, const string& newAddress) {
+    if (rejectOnReplica())
+        return;
+    lock_guard<mutex> lock(writerMutex);
+    TraceScope trace("update_patient", {patientID, newName, newPhone, newAddress});
+    PatientRecord patient;
+    if (!patients.find(patientID, patient)) {
+        cout << "Patient not found.\n";
         return;
     }
-    for (const auto& entry : appointmentPrimaryIndex) {
-        appointmentIndexFile << entry.first << "|" << entry.second << "\n";
+    if (!newName.empty())
+        patient.get<PatientSchema::NAME>() = newName;
+    if (!newPhone.empty())
+        patient.get<PatientSchema::PHONE>() = newPhone;
+    if (!newAddress.empty())
+        patient.get<PatientSchema::ADDRESS>() = newAddress;
+    if (const char* error = patients.update(patient)) {
+        cout << error << "\n";
+        return;
     }
-    appointmentIndexFile.close();
-
-    doctorSecondaryIndex.save();
-    appointmentSecondaryIndex.save();
-
-    saveAvailList(doctorAvailList, "doctor.avail");
-    saveAvailList(appointmentAvailList, "appointment.avail");
+    patients.save();
+    logChange({"update_patient", patientID, newName, newPhone, newAddress});
+    cout << "Patient updated successfully.\n";
 }
 
-
-void HealthcareManagementSystem::updateDoctor() {
-    string doctorID;
-    cout << "Enter Doctor ID to update: ";
-    cin >> doctorID;
-    int pos = binarySearch(doctorPrimaryIndex, doctorID);
-    if (pos == -1) {
-        cout << "Doctor not found.\n";
+// The patient's appointments stay; only their links to the patient are removed.
+void HealthcareManagementSystem::deletePatient(const string& patientID) {
+    if (rejectOnReplica())
+        return;
+    lock_guard<mutex> lock(writerMutex);
+    TraceScope trace("delete_patient", {patientID});
+    if (!patients.remove(patientID)) {
+        cout << "Patient not found.\n";
         return;
     }
-    string record = readRecordFromFile(DOCTOR_FILE, doctorPrimaryIndex[pos].second);
-    if (record.empty()) {
-        cout << "Error reading the doctor record.\n";
+    for (const string& appointmentID : patientAppointments.keysBy<PatientAppointmentSchema::PATIENT_ID>(patientID))
+        patientAppointments.remove(appointmentID);
+    patients.save();
+    patientAppointments.save();
+    logChange({"delete_patient", patientID});
+    cout << "Patient deleted successfully.\n";
+}
+
+// An appointment belongs to at most one patient; linking it again moves it.
+void HealthcareManagementSystem::linkAppointmentToPatient(const string& appointmentID, const string& patientID) {
+    if (rejectOnReplica())
+        return;
+    lock_guard<mutex> lock(writerMutex);
+    TraceScope trace("link_appointment", {appointmentID, patientID});
+    PatientRecord patient;
+    if (!patients.find(patientID, patient)) {
+        cout << "Patient not found.\n";
         return;
     }
-    int recordLength = stoi(record.substr(0, 4));
-    size_t d1 = record.find('|');
-    size_t d2 = record.find('|', d1 + 1);
-    string name = record.substr(d1 + 1, d2 - d1 - 1);
-    string address = record.substr(d2 + 1);
-    string newName, newAddress;
-    cout << "Enter new name (leave blank to keep current): ";
-    cin.ignore();
-    getline(cin, newName);
-    cout << "Enter new address (leave blank to keep current): ";
-    getline(cin, newAddress);
-    if (newName.empty()) {
-        newName = name;
+    if (!findAppointment(appointmentID)) {
+        cout << "Appointment not found.\n";
+        return;
     }
-    if (newAddress.empty()) {
-        newAddress = address;
+    PatientAppointmentRecord link{{appointmentID, patientID}};
+    PatientAppointmentRecord existing;
+    const char* error = patientAppointments.find(appointmentID, existing) ? patientAppointments.update(link)
+                                                                           : patientAppointments.insert(link);
+    if (error) {
+        cout << error << "\n";
+        return;
     }
-    doctorSecondaryIndex.remove(name, doctorID);
-    string newRecord = doctorID + "|" + newName + "|" + newAddress;
-    int newRecordLength = newRecord.length();
-    if (newRecordLength != recordLength) {
-        cout << "Error: New record length should be " << recordLength << " characters.\n";
+    patientAppointments.save();
+    logChange({"link_appointment", appointmentID, patientID});
+    cout << "Appointment linked to patient successfully.\n";
+}
+
+void HealthcareManagementSystem::displayPatientRecord(const PatientRecord& patient) {
+    cout << "\n--- Patient Details ---\n";
+    cout << "Patient ID: " << patient.get<PatientSchema::ID>() << "\n";
+    cout << "Name: " << patient.get<PatientSchema::NAME>() << "\n";
+    cout << "Phone: " << patient.get<PatientSchema::PHONE>() << "\n";
+    cout << "Address: " << patient.get<PatientSchema::ADDRESS>() << "\n";
+    cout << "------------------------\n";
+}
+
+void HealthcareManagementSystem::searchPatientByID(const string& patientID) {
+    TraceScope trace("search_patient", {patientID});
+    PatientRecord patient;
+    if (!patients.find(patientID, patient)) {
+        cout << "Patient not found.\n";
         return;
     }
-    fstream doctorFile(DOCTOR_FILE, ios::in | ios::out);
-    doctorFile.seekp(doctorPrimaryIndex[pos].second, ios::beg);
-    if (readRecordFromFile(DOCTOR_FILE, doctorPrimaryIndex[pos].second).back() == '*') {
-        doctorFile.seekp(doctorPrimaryIndex[pos].second + newRecord.length() - 1, ios::beg);
-        doctorFile.put(' ');
+    displayPatientRecord(patient);
+}
+
+void HealthcareManagementSystem::searchPatientsByName(const string& name) {
+    TraceScope trace("search_patient_name", {name});
+    vector<string> patientIDs = patients.keysBy<PatientSchema::NAME>(name);
+    if (patientIDs.empty()) {
+        cout << "No patients found with the name: " << name << endl;
+        return;
     }
-    stringstream ss;
-    ss << setw(4) << setfill('0') << newRecordLength;
-    string fixedLength = ss.str();
-    doctorFile << fixedLength << newRecord;
-    doctorFile.close();
-    doctorPrimaryIndex[pos].first = doctorID;
-    doctorSecondaryIndex.Insert(newName, doctorID);
-    saveIndexes();
-    doctorSecondaryIndex.save();
-    cout << "Doctor record updated successfully.\n";
+    for (const string& patientID : patientIDs)
+        searchPatientByID(patientID);
 }
-void HealthcareManagementSystem::searchNameForQuary(string doctorID) {
-    for (auto& entry : doctorSecondaryIndex.Index) {
-        // Get the list of doctor IDs for a particular doctor name
-        DoctorNode* doctorIDs = entry.second.head;  // The list of doctor IDs for this name
 
-        while (doctorIDs) {
-            // If we find the doctorID in the secondary index, we found the name
-            if (doctorIDs->doctorID == doctorID) {
-                // Now that we found the doctor ID, extract the name from the current entry
-                string doctorName = entry.first;  // The key of the map is the doctorName
+void HealthcareManagementSystem::searchAppointmentsByPatientID(const string& patientID) {
+    TraceScope trace("search_patient_appointments", {patientID});
+    vector<string> appointmentIDs = patientAppointments.keysBy<PatientAppointmentSchema::PATIENT_ID>(patientID);
+    if (appointmentIDs.empty()) {
+        cout << "No appointments found for Patient ID: " << patientID << endl;
+        return;
+    }
+    cout << "\nAppointments for Patient ID: " << patientID << "\n";
+    for (const string& appointmentID : appointmentIDs)
+        searchAppointmentsByID(appointmentID);
+}
 
-                cout << doctorName << "\n";
-                return;
-            }
-            doctorIDs = doctorIDs->next;  // Move to the next doctor ID in the linked list
+void HealthcareManagementSystem::managePatients() {
+    int option;
+    cout << "\n--- Patients ---\n";
+    cout << "1. Add Patient\n";
+    cout << "2. Update Patient\n";
+    cout << "3. Delete Patient\n";
+    cout << "4. Link Appointment to Patient\n";
+    cout << "5. Search Patient by ID\n";
+    cout << "6. Search Patients by Name\n";
+    cout << "7. Search Appointments by Patient ID\n";
+    cout << "Enter your choice: ";
+    cin >> option;
+    string patientID, name, phone, address, appointmentID;
+    switch (option) {
+        case 1:
+        case 2: {
+            const char* keep = option == 2 ? " (leave blank to keep current)" : "";
+            cout << "Enter Patient ID: ";
+            cin >> patientID;
+            cin.ignore();
+            cout << "Enter Patient Name" << keep << ": ";
+            getline(cin, name);
+            cout << "Enter Patient Phone" << keep << ": ";
+            getline(cin, phone);
+            cout << "Enter Patient Address" << keep << ": ";
+            getline(cin, address);
+            if (option == 1)
+                addPatient(patientID, name, phone, address);
+            else
+                updatePatient(patientID, name, phone, address);
+            break;
         }
+        case 3:
+            cout << "Enter Patient ID to delete: ";
+            cin >> patientID;
+            deletePatient(patientID);
+            break;
+        case 4:
+            cout << "Enter Appointment ID: ";
+            cin >> appointmentID;
+            cout << "Enter Patient ID: ";
+            cin >> patientID;
+            linkAppointmentToPatient(appointmentID, patientID);
+            break;
+        case 5:
+            cout << "Enter Patient ID to search: ";
+            cin >> patientID;
+            searchPatientByID(patientID);
+            break;
+        case 6:
+            cout << "Enter Patient Name to search: ";
+            cin.ignore();
+            getline(cin, name);
+            searchPatientsByName(name);
+            break;
+        case 7:
+            cout << "Enter Patient ID to search: ";
+            cin >> patientID;
+            searchAppointmentsByPatientID(patientID);
+            break;
+        default:
+            cout << "Invalid choice.\n";
     }
-
-    // If we reach here, no doctor with the specified ID was found in the secondary index
-    cout << "No doctor found with the ID: " << doctorID << endl;
 }
 
-void HealthcareManagementSystem::processQuery(const string& query) {
-    // Preprocess the query: remove spaces and ignore case permutations
-    string processedQuery = ignoreKeysCasePermutations(query);
-    processedQuery.erase(remove(processedQuery.begin(), processedQuery.end(), ' '), processedQuery.end());
-
-    // Validate the query
-    while (!isValidQuery(processedQuery)) {
-        cout << "Invalid query. Please try again.\n";
-        cout << "Enter your query: ";
-        getline(cin, processedQuery);
-        processedQuery = ignoreKeysCasePermutations(processedQuery);
-        processedQuery.erase(remove(processedQuery.begin(), processedQuery.end(), ' '), processedQuery.end());
+void HealthcareManagementSystem::showStats() {
+    metrics.display();
+    metrics.dumpPrometheus();
+    {
+        lock_guard<mutex> cacheLock(planCacheMutex);
+        cout << "Query plans cached: " << planCache.size() << " (" << planCacheHits.load() << " hits, "
+             << planCacheMisses.load() << " misses)\n";
     }
+    cout << "Interned strings: " << stringPool.size() << " (~" << stringPool.memoryUsage() / 1024 << " KiB)\n";
+    cout << "Metrics written to " << metrics.METRICS_FILE << "\n";
+}
 
-    // Extract the field name after 'select' (between 'select' and 'from')
-    size_t selectPos = processedQuery.find("select") + 6;  // Skip 'select' (length = 6)
-    size_t fromPos = processedQuery.find("from");
+// Replays a trace recorded with --record against an empty data directory and reports
+// throughput, latency percentiles and bytes written per operation. Without a rate,
+// each operation starts when the previous one finishes. With one, operation i is due
+// i/rate seconds after the start and its latency is counted from then, so falling
+// behind shows up as latency instead of quietly lowering the offered load. Operations
+// still run one at a time in trace order, since later ones depend on earlier ones.
+int runReplay(const string& traceFile, const string& dataDir, double rate) {
+    ifstream trace(traceFile, ios::in);
+    if (!trace) {
+        cerr << "Error: Unable to open " << traceFile << " for reading." << endl;
+        return 1;
+    }
+    vector<vector<string>> operations;
+    string line;
+    for (int lineNumber = 1; getline(trace, line); lineNumber++) {
+        if (line.find_first_not_of(" \t\r") == string::npos)
+            continue;
+        vector<string> entry;
+        if (!TraceRecorder::parse(line, entry)) {
+            cerr << "Error: " << traceFile << ":" << lineNumber << " is not a trace entry." << endl;
+            return 1;
+        }
+        operations.push_back(entry);
+    }
 
-    // Extract the field (e.g., 'doctorname' or '*')
-    string fieldName = processedQuery.substr(selectPos, fromPos - selectPos);
+    error_code error;
+    filesystem::create_directories(dataDir, error);
+    if (error || !filesystem::is_empty(dataDir, error)) {
+        cerr << "Error: Replay needs a new or empty data directory, and " << dataDir << " is not one." << endl;
+        return 1;
+    }
+    filesystem::current_path(dataDir);
+    for (const char* file : {"doctors.txt", "appointments.txt", "doctor.avail", "appointment.avail"})
+        ofstream(file, ios::out);
 
-    // Extract table name (between 'from' and 'where')
-    size_t wherePos = processedQuery.find("where");
-    string tableName = processedQuery.substr(fromPos + 4, wherePos - fromPos - 4);
+    HealthcareManagementSystem system;
+    system.loadIndexes();
 
-    // Extract field name (between 'where' and '=')
-    size_t fieldStartPos = wherePos + 5;  // Skip 'where'
-    size_t equalPos = processedQuery.find('=');
-    string queryFieldName = processedQuery.substr(fieldStartPos, equalPos - fieldStartPos);
+    struct OperationStats {
+        vector<uint64_t> latencies;  // nanoseconds
+        uint64_t bytesWritten = 0;
+    };
+    map<string, OperationStats> stats;
+    OperationStats total;
+    // Nothing in a trace should wait for the keyboard or print to it.
+    istringstream noInput;
+    streambuf* keyboard = cin.rdbuf(noInput.rdbuf());
+    streambuf* console = cout.rdbuf(nullptr);
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < operations.size(); i++) {
+        auto due = chrono::steady_clock::now();
+        if (rate > 0) {
+            due = start + chrono::nanoseconds((int64_t)(i * 1e9 / rate));
+            this_thread::sleep_until(due);
+        }
+        uint64_t bytesBefore = metrics.totalBytesWritten();
+        system.replayOperation(operations[i]);
+        uint64_t latency = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - due).count();
+        uint64_t bytes = metrics.totalBytesWritten() - bytesBefore;
+        for (OperationStats* target : {&stats[operations[i][0]], &total}) {
+            target->latencies.push_back(latency);
+            target->bytesWritten += bytes;
+        }
+        cin.clear();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout.rdbuf(console);
+    cout.clear();
+    cin.rdbuf(keyboard);
+    system.saveIndexes();
 
-    // Extract field value (between the single quotes)
-    size_t firstQuotePos = processedQuery.find('\'') + 1;  // Skip the first quote
-    size_t secondQuotePos = processedQuery.find('\'', firstQuotePos);
-    string fieldValue = processedQuery.substr(firstQuotePos, secondQuotePos - firstQuotePos);
+    cout << "Replayed " << operations.size() << " operations into " << dataDir << " in " << fixed << setprecision(3)
+         << seconds << " s (" << setprecision(1) << (seconds > 0 ? operations.size() / seconds : 0.0) << " ops/s, ";
+    if (rate > 0)
+        cout << "open loop at " << rate << " ops/s).\n";
+    else
+        cout << "closed loop).\n";
+    cout << left << setw(28) << "operation" << right << setw(10) << "count" << setw(12) << "ops/s"
+         << setw(12) << "p50(us)" << setw(12) << "p95(us)" << setw(12) << "p99(us)" << setw(12) << "max(us)"
+         << setw(14) << "bytes/op" << "\n";
+    auto print = [seconds](const string& name, OperationStats& row) {
+        vector<uint64_t>& sorted = row.latencies;
+        sort(sorted.begin(), sorted.end());
+        auto percentile = [&sorted](double fraction) {
+            return sorted[min(sorted.size() - 1, (size_t)ceil(fraction * sorted.size()) - 1)] / 1000.0;
+        };
+        cout << left << setw(28) << name << right << setw(10) << sorted.size()
+             << setprecision(1) << setw(12) << (seconds > 0 ? sorted.size() / seconds : 0.0)
+             << setprecision(2) << setw(12) << percentile(0.50) << setw(12) << percentile(0.95)
+             << setw(12) << percentile(0.99) << setw(12) << sorted.back() / 1000.0
+             << setprecision(1) << setw(14) << (double)row.bytesWritten / sorted.size() << "\n";
+    };
+    for (auto& [name, row] : stats)
+        print(name, row);
+    if (!operations.empty())
+        print("total", total);
+    cout.unsetf(ios::fixed);
+    cout << setprecision(6);
+    return 0;
+}
 
-    if (tableName == "doctors") {
-        if (queryFieldName == "doctorid"&& fieldName == "*") {
-            searchDoctorByID(fieldValue);
-        } else if (queryFieldName == "doctorid" &&fieldName == "doctorname") {
-            searchNameForQuary(fieldValue);
+int main(int argc, char* argv[]) {
+    string replicaSource, recordFile, replayFile, replayDir;
+    double replayRate = 0;
+    for (int i = 1; i < argc; i += 2) {
+        string option = argv[i];
+        if (i + 1 == argc || (option != "--replica" && option != "--record" && option != "--replay" &&
+                              option != "--dir" && option != "--rate")) {
+            cerr << "Usage: " << argv[0] << " [--replica <primary dir or log>] [--record <trace.jsonl>]\n"
+                 << "       " << argv[0] << " --replay <trace.jsonl> --dir <empty dir> [--rate <ops per second>]" << endl;
+            return 1;
+        }
+        string value = argv[i + 1];
+        if (option == "--replica")
+            replicaSource = value;
+        else if (option == "--record")
+            recordFile = value;
+        else if (option == "--replay")
+            replayFile = value;
+        else if (option == "--dir")
+            replayDir = value;
+        else {
+            char* end;
+            replayRate = strtod(value.c_str(), &end);
+            if (value.empty() || *end != '\0' || !(replayRate > 0)) {
+                cerr << "Error: --rate must be a positive number of operations per second." << endl;
+                return 1;
+            }
         }
-    } else if (tableName == "appointments") {
-        if (queryFieldName == "appointmentid") {
-            searchAppointmentsByID(fieldValue);
-        } else if (queryFieldName == "doctorid") {
-            searchAppointmentsByDoctorID(fieldValue);
+    }
+    if (!replayFile.empty() || !replayDir.empty()) {
+        if (replayFile.empty() || replayDir.empty()) {
+            cerr << "Error: --replay and --dir go together." << endl;
+            return 1;
         }
+        return runReplay(replayFile, replayDir, replayRate);
     }
-}
-int main() {
+
     HealthcareManagementSystem system;
     HealthcareManagementSystem query;
     system.loadIndexes();
+    if (!recordFile.empty() && !workloadTrace.open(recordFile))
+        return 1;
+    if (!replicaSource.empty() && !system.startReplica(replicaSource))
+        return 1;
     int choice;
 
     do {
         system.displayMenu();
         cin >> choice;
+        if (system.isReplica())
+            system.catchUpReplica();
 
         switch (choice) {
             case 1: {  // Add New Doctor
@@ -1011,6 +5223,55 @@ int main() {
                 break;
             }
             case 12: {
+                system.showStats();
+                break;
+            }
+            case 13: {
+                string cutoffDate;
+                cout << "Compress appointments dated before (YYYY-MM-DD): ";
+                cin >> cutoffDate;
+                system.compressAppointments(cutoffDate);
+                break;
+            }
+            case 14: {
+                string cutoffDate;
+                cout << "Archive appointments dated before (YYYY-MM-DD): ";
+                cin >> cutoffDate;
+                system.archiveAppointments(cutoffDate);
+                break;
+            }
+            case 15: {
+                string doctorID, after;
+                cout << "Enter Doctor ID: ";
+                cin >> doctorID;
+                cout << "Find first free slot after (YYYY-MM-DD HH:MM): ";
+                cin.ignore();
+                getline(cin, after);
+                system.findNextFreeSlot(doctorID, after);
+                break;
+            }
+            case 16: {
+                string at;
+                cout << "Enter time (YYYY-MM-DD HH:MM): ";
+                cin.ignore();
+                getline(cin, at);
+                system.findFreeDoctors(at);
+                break;
+            }
+            case 17: {
+                system.showLoadReport();
+                break;
+            }
+            case 18: {
+                system.exportColumnarSnapshot();
+                break;
+            }
+            case 19: {
+                system.managePatients();
+                break;
+            }
+            case 20: {
+                metrics.dumpPrometheus();
                 cout << "Exiting...\n";
                 std::exit(0);
                 // no need to break here
@@ -1020,7 +5281,7 @@ int main() {
                 break;
             }
         }
-    } while (choice>0 && choice<13);
+    } while (choice>0 && choice<21);
     system.saveIndexes();
     return 0;
 }
\ No newline at end of file